@@ -14,6 +14,9 @@
 
 #include "dedispersionlite.h"
 #include "mjd.h"
+#include "arena.h"
+#include "phasepredictor.h"
+#include "t2predictor.h"
 
 using namespace std;
 
@@ -39,7 +42,6 @@ namespace Pulsar
             npol = integ.npol;
             nchan = integ.nchan;
             nbin = integ.nbin;
-            data = integ.data;
         }
         IntegrationLite & operator=(const IntegrationLite &integ)
         {
@@ -49,7 +51,6 @@ namespace Pulsar
             npol = integ.npol;
             nchan = integ.nchan;
             nbin = integ.nbin;
-            data = integ.data;
 
             return *this;
         }
@@ -59,7 +60,6 @@ namespace Pulsar
             npol = np;
             nchan = nc;
             nbin = nb;
-            data.resize(npol*nchan*nbin, 0.);
         }
     public:
         double ffold;
@@ -69,8 +69,6 @@ namespace Pulsar
         int npol;
         int nchan;
         int nbin;
-
-        vector<float> data;
     };
 
     class ArchiveLite
@@ -80,27 +78,30 @@ namespace Pulsar
         ArchiveLite(const ArchiveLite &arch);
         ArchiveLite & operator=(const ArchiveLite &arch);
         ~ArchiveLite();
-        void close()
+        void close();
+        /** preallocate the store for nsub subints, so that folding them does not reallocate it */
+        void reserve(long int nsub)
         {
-            for (auto p=profiles.begin(); p!=profiles.end(); ++p)
-            {
-                p->data.clear();
-                p->data.shrink_to_fit();
-            }
+            profiles.reserve(nsub);
+            if (mapped == NULL)
+                data.reserve(nsub*npol*nchan*nbin);
         }
+        bool map(int fd, long int offset, long int nsub);
+        bool spilled() const {return mapped != NULL;}
+        /** the store, in the spill file if it is mapped */
+        float * get_data() {return mapped != NULL ? mapped : data.data();}
+        void append(ArchiveLite &arch);
         void prepare(DataBuffer<float> &databuffer);
-        bool runDspsr(DataBuffer<float> &databuffer);
-        bool runTRLSM(DataBuffer<float> &databuffer);
+        bool runDspsr(const DataBuffer<float> &databuffer);
+        bool runTRLSM(const DataBuffer<float> &databuffer);
+        bool runTRLSM(const DedispersionLite &dedisp, int idm);
         void resize(int np, int nc, int nb);
         void dump2bin(const string &rootname)
         {
             ofstream outfile;
             outfile.open(rootname+".spft", ofstream::binary);
 
-            for (auto pro=profiles.begin(); pro!=profiles.end(); ++pro)
-            {
-                outfile.write((char *)(&((*pro).data[0])), sizeof(float)*npol*nchan*nbin);
-            }
+            outfile.write((char *)get_data(), sizeof(float)*profiles.size()*npol*nchan*nbin);
             outfile.close();
         }
     private:
@@ -136,6 +137,10 @@ namespace Pulsar
 
             return MJD((tepoch+ref_epoch.to_second())/86400.);
         }
+        MJD fit_subint(long int nsamples, double tsamp);
+        long int plan_trlsm(float *mxWTW, int *lbin, int *nphi, float *w0, float *w1, long int nsamples, double tsamp);
+        void solve_trlsm(float *sub, float *mxWTW, float *vWTd_T, long int nchans, long int maxnphi, double tspan);
+        float * new_subint();
     public:
         MJD start_mjd;
         MJD ref_epoch;
@@ -144,15 +149,33 @@ namespace Pulsar
         double acc;
         double dm;
         double snr;
+        /** folds with the tempo2 predictor instead of f0 and f1 if not empty */
+        T2Predictor t2pred;
+        /** frequency the data are dedispersed to (MHz) */
+        double fref;
     public:
         int nbin;
         int nchan;
         int npol;
         double tbin;
         vector<double> frequencies;
+        /** header of each subint */
         vector<IntegrationLite> profiles;
+        /** (nsubint, npol, nchan, nbin), subint l of profiles is at l*npol*nchan*nbin */
+        vector<float> data;
         MJD sub_mjd;
         IntegrationLite sub_int;
+    private:
+        /** phase of the current subint */
+        PhasePredictor predictor;
+        /** temporaries of runDspsr and runTRLSM, reset for each subint */
+        Arena arena;
+        vector<pair<long int, long int>> chranges;
+        /** the store mapped from the spill file, copies hold it in memory */
+        void *mapaddr;
+        size_t maplen;
+        float *mapped;
+        long int nmapped;
     };
 }
 
@@ -77,6 +77,9 @@ public:
     string src_name;
     string ra;
     string dec;
+    /** written to the PSRPARAM and T2PREDICT tables if not empty */
+    vector<string> psrparam;
+    vector<string> t2predict;
 public:
     MJD start_mjd;
     int npol;
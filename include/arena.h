@@ -0,0 +1,63 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-12 10:26:41
+ * @modify date 2020-11-12 10:26:41
+ * @desc scratch memory for the temporaries of a pipeline stage, reused from chunk to chunk
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+#define ARENA_ALIGN 64
+#define ARENA_BLOCK 65536
+
+/**
+ * @brief Bump allocator, alloc hands out 64-byte aligned arrays of trivial types (no constructor runs),
+ *        reset frees all of them at once. Blocks added while a chunk grows are merged into one on reset,
+ *        so once the largest chunk has been seen alloc does no heap allocation.
+ *        An arena belongs to one stage and is used by one thread; copies start empty.
+ */
+class Arena
+{
+public:
+    Arena();
+    Arena(const Arena &arena);
+    Arena & operator=(const Arena &arena);
+    ~Arena();
+    void *allocate(size_t nbytes);
+    void reset();
+    void release();
+    size_t capacity() const;
+    template <typename T>
+    T *alloc(size_t n)
+    {
+        return (T *)allocate(sizeof(T)*n);
+    }
+    template <typename T>
+    T *alloc(size_t n, T value)
+    {
+        T *p = alloc<T>(n);
+        fill(p, p+n, value);
+        return p;
+    }
+private:
+    void grow(size_t nbytes);
+private:
+    vector<char *> blocks;
+    /** end of the usable bytes of each block */
+    vector<size_t> sizes;
+    /** offset in the last block */
+    size_t offset;
+    /** bytes handed out since reset, and the most ever */
+    size_t used;
+    size_t peak;
+};
+
+#endif /* ARENA_H_ */
@@ -14,6 +14,7 @@
 #include <algorithm>
 #include <string.h>
 #include <complex>
+#include <utility>
 
 #ifdef __AVX2__
 #include <boost/align/aligned_allocator.hpp>
@@ -40,6 +41,7 @@ public:
     void dump(const string fname);
     void resize(long int ns, int nc);
     void get_mean_rms(vector<T> &mean, vector<T> &var);
+    void get_chranges(vector<pair<long int, long int>> &ranges) const;
 public:
     bool equalized;
     long int counter;
@@ -47,6 +49,8 @@ public:
     double tsamp;
     int nchans;
     vector<double> frequencies;
+    /** channel mask, 0 for channels that are zero over the whole chunk */
+    vector<int> chmask;
 #ifdef __AVX2__
     vector<T, boost::alignment::aligned_allocator<T, 32>> buffer;
 #else
@@ -12,6 +12,7 @@
 #include <fstream>
 
 #include "databuffer.h"
+#include "utils.h"
 
 using namespace std;
 
@@ -27,14 +28,20 @@ namespace Pulsar
             delayn.clear();
             delayn.shrink_to_fit();
 
-            buffer.clear();
-            buffer.shrink_to_fit();
+            bufferT.clear();
+            bufferT.shrink_to_fit();
 
-            buffersub.clear();
-            buffersub.shrink_to_fit();
+            bufferchunk.clear();
+            bufferchunk.shrink_to_fit();
+
+            buffersubT.clear();
+            buffersubT.shrink_to_fit();
 
             buffertim.clear();
             buffertim.shrink_to_fit();
+
+            subdata.clear();
+            subdata.shrink_to_fit();
         }
         void prepare(DataBuffer<float> &databuffer);
         void run(DataBuffer<float> &databuffer);
@@ -43,7 +50,7 @@ namespace Pulsar
             ofstream outfile;
             outfile.open(rootname+".sub", ios::binary|ios::app);
 
-            outfile.write((char *)(&buffersub[0]+idm*ndump*nsubband), sizeof(float)*ndump*nsubband);
+            outfile.write((char *)(&subdata[dmidx[idm]].buffer[0]), sizeof(float)*ndump*nsubband);
         
             outfile.close();
         }
@@ -53,31 +60,45 @@ namespace Pulsar
             ofstream outfile;
             outfile.open(rootname+".tim", ios::binary|ios::app);
 
-            outfile.write((char *)(&buffertim[0]+idm*ndump), sizeof(float)*ndump);
+            outfile.write((char *)(&buffertim[0]+dmidx[idm]*ndump), sizeof(float)*ndump);
         
             outfile.close();
         }
 
-        void get_subdata(DataBuffer<float> &databuffer, int idm)
+        void get_subdata(DataBuffer<float> &databuffer, int idm) const
+        {
+            databuffer = subdata[dmidx[idm]];
+        }
+
+        /**
+         * @brief Subband data of vdm[idm] in the last chunk, shared by all the dms with the same delays
+         */
+        const DataBuffer<float> & get_subdata(int idm) const
+        {
+            return subdata[dmidx[idm]];
+        }
+
+        /**
+         * @brief Channel j of the last chunk dedispersed to vdm[idm] in direct mode, ndump samples in bufferT,
+         *        NULL if the channel is zero there
+         */
+        const float * get_chandata(int idm, long int j) const
         {
-            databuffer.resize(ndump, nsubband);
-            databuffer.tsamp = tsamp;
-            databuffer.frequencies = frequencies_sub;
-
-            for (long int i=0; i<ndump; i++)
-            {
-                for (long int j=0; j<nsubband; j++)
-                {
-                    databuffer.buffer[i*nsubband+j] = buffersub[idm*ndump*nsubband+i*nsubband+j];
-                }
-            }
-
-            databuffer.counter += ndump;
+            long int d = delayn[j*ndm+dmidx[idm]];
+            if (d >= nsamples-zerolen[j])
+                return NULL;
+            return &bufferT[j*nsamples+d];
         }
     public:
         int nsubband;
         vector<double> vdm;
+        /** do not form the subbands, the folders read the delayed channels with get_chandata */
+        bool direct;
     public:
+        /** number of distinct dms that are dedispersed, dms with the same delays of all channels give the same data */
+        int ndm;
+        /** index of the distinct dm of each entry of vdm */
+        vector<int> dmidx;
         long int counter;
         long int offset;
         int nchans;
@@ -85,11 +106,21 @@ namespace Pulsar
         int ndump;
         int nsamples;
         vector<double> frequencies;
+        /** (nchans, ndm) */
         vector<long int> delayn;
-        vector<float> buffer;
+        /** number of trailing zero samples of each channel in bufferT */
+        vector<long int> zerolen;
+        /** 0 for subbands of a dm that get no channel in this chunk */
+        vector<int> submask;
+        /** history, (nchans, nsamples), the last chunk is at the end after run */
+        vector<float> bufferT;
+        vector<float> bufferchunk;
         vector<double> frequencies_sub;
         vector<float> buffertim;
-        vector<float> buffersub;
+        /** (ndm, nsubband, ndump) */
+        vector<float> buffersubT;
+        /** (ndm), time-major (ndump, nsubband) of each distinct dm */
+        vector<DataBuffer<float>> subdata;
     public:
         static double dmdelay(double dm, double fh, double fl)
 	    {
@@ -25,5 +25,19 @@ public:
     int fd;
 };
 
+/**
+ * @brief Sum a time-major block by td in time and fd in frequency,
+ *        specialized kernels are used for td, fd in {1, 2, 4, 8, 16}
+ *
+ * @param out: (nsamples/td, nchans/fd)
+ * @param in: (nsamples, nchans)
+ * @param nsamples: number of input samples, multiple of td
+ * @param nchans: number of input channels, the last nchans%fd channels are dropped
+ * @param td: time downsample
+ * @param fd: frequency downsample
+ * @param parallel: run with num_threads threads, false when called per tile inside a parallel region
+ */
+void downsample_sum(float *out, const float *in, long int nsamples, long int nchans, int td, int fd, bool parallel=true);
+
 
 #endif /* DOWNSAMPLE_H_ */
\ No newline at end of file
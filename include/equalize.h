@@ -8,8 +8,49 @@
 #ifndef EQUALIZE_H_
 #define EQUALIZE_H_
 
+#include <string>
+
 #include "databuffer.h"
 
+/**
+ * @brief Per-channel mean and std used for equalization, estimated from the current chunk only (CHUNK),
+ *        or carried across chunks with an exponentially weighted (EWMA) or sliding-window (WINDOW) estimator
+ *        of the mean and power, or with a streaming median and MAD (ROBUST, O(1) per sample)
+ */
+class ChannelStatistics
+{
+public:
+    enum Mode{CHUNK, EWMA, WINDOW, ROBUST};
+public:
+    ChannelStatistics();
+    ~ChannelStatistics();
+    void prepare(long int nchans, long int nsamples, double tsamp);
+    void update(const double *chsum, const double *chsum2, long int n);
+    void update_robust(const float *data, long int n, const int *mask=NULL);
+    void get(vector<double> &chmean, vector<double> &chstd) const;
+    static bool parse_mode(const string &s, enum Mode &m);
+public:
+    enum Mode mode;
+    /** time scale of the EWMA, WINDOW and ROBUST estimators (s) */
+    double timescale;
+private:
+    long int nchans;
+    double tsamp;
+    long int nupdate;
+    vector<double> mean;
+    vector<double> power;
+    /** WINDOW: sums of the last nwindow chunks */
+    long int nwindow;
+    vector<double> winsum;
+    vector<double> winsum2;
+    vector<long int> winn;
+    /** ROBUST: streaming median and MAD */
+    vector<float> median;
+    vector<float> mad;
+    /** ROBUST: per-thread copy of a channel for the exact median and MAD */
+    vector<float> chdata;
+};
+
 class Equalize : public DataBuffer<float>
 {
 public:
@@ -19,9 +60,11 @@ public:
     ~Equalize();
     void prepare(DataBuffer<float> &databuffer);
     void run(DataBuffer<float> &databuffer);
+public:
+    ChannelStatistics stats;
 private:
     vector<double> chmean;
     vector<double> chstd;
 };
 
-#endif /* EQUALIZE_H_ */
\ No newline at end of file
+#endif /* EQUALIZE_H_ */
@@ -0,0 +1,266 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-03 10:12:41
+ * @modify date 2020-11-03 10:12:41
+ * @desc 16-bit float storage (IEEE half and bfloat16), values are converted to float on load
+ */
+
+#ifndef FLOAT16_H_
+#define FLOAT16_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__F16C__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+/** IEEE 754 half precision */
+struct float16_t
+{
+    uint16_t bits;
+};
+
+/** bfloat16, the upper half of a float */
+struct bfloat16_t
+{
+    uint16_t bits;
+};
+
+/**
+ * @brief Convert float to half, round to nearest even
+ */
+inline float16_t float2half(float f)
+{
+    float16_t h;
+#ifdef __F16C__
+    h.bits = _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+    const uint32_t f32infty = 255u << 23;
+    const uint32_t f16max = (127u+16) << 23;
+    const uint32_t denorm_magic = ((127u-15)+(23-10)+1) << 23;
+
+    uint32_t x;
+    memcpy(&x, &f, sizeof(float));
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    if (x >= f16max)
+    {
+        /** inf or nan */
+        h.bits = (x > f32infty) ? 0x7e00 : 0x7c00;
+    }
+    else if (x < (113u << 23))
+    {
+        /** subnormal or zero */
+        float a, m;
+        memcpy(&a, &x, sizeof(float));
+        memcpy(&m, &denorm_magic, sizeof(float));
+        a += m;
+        memcpy(&x, &a, sizeof(float));
+        h.bits = x - denorm_magic;
+    }
+    else
+    {
+        uint32_t mant_odd = (x >> 13) & 1;
+        x += ((uint32_t)(15-127) << 23) + 0xfff;
+        x += mant_odd;
+        h.bits = x >> 13;
+    }
+
+    h.bits |= sign >> 16;
+#endif
+    return h;
+}
+
+/**
+ * @brief Convert half to float
+ */
+inline float half2float(float16_t h)
+{
+#ifdef __F16C__
+    return _cvtsh_ss(h.bits);
+#else
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    const uint32_t magic = 113u << 23;
+
+    uint32_t x = (h.bits & 0x7fffu) << 13;
+    uint32_t exp = shifted_exp & x;
+    x += (127u-15) << 23;
+
+    float f;
+    if (exp == shifted_exp)
+    {
+        /** inf or nan */
+        x += (128u-16) << 23;
+        memcpy(&f, &x, sizeof(float));
+    }
+    else if (exp == 0)
+    {
+        /** subnormal or zero */
+        x += 1u << 23;
+        float m;
+        memcpy(&f, &x, sizeof(float));
+        memcpy(&m, &magic, sizeof(float));
+        f -= m;
+    }
+    else
+    {
+        memcpy(&f, &x, sizeof(float));
+    }
+
+    uint32_t sign = (uint32_t)(h.bits & 0x8000u) << 16;
+    memcpy(&x, &f, sizeof(float));
+    x |= sign;
+    memcpy(&f, &x, sizeof(float));
+    return f;
+#endif
+}
+
+/**
+ * @brief Convert float to bfloat16, round to nearest even
+ */
+inline bfloat16_t float2bf16(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(float));
+
+    bfloat16_t b;
+    if ((x & 0x7fffffffu) > 0x7f800000u)
+    {
+        /** quiet nan */
+        b.bits = (x >> 16) | 0x40;
+        return b;
+    }
+
+    x += 0x7fffu + ((x >> 16) & 1);
+    b.bits = x >> 16;
+    return b;
+}
+
+/**
+ * @brief Convert bfloat16 to float
+ */
+inline float bf162float(bfloat16_t b)
+{
+    uint32_t x = (uint32_t)b.bits << 16;
+    float f;
+    memcpy(&f, &x, sizeof(float));
+    return f;
+}
+
+/**
+ * @brief Store n floats
+ */
+inline void cvt_store(float *out, const float *in, long int n)
+{
+    memcpy(out, in, sizeof(float)*n);
+}
+
+inline void cvt_store(float16_t *out, const float *in, long int n)
+{
+    long int i = 0;
+#ifdef __F16C__
+    for (; i+8<=n; i+=8)
+    {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in+i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(out+i), h);
+    }
+#endif
+    for (; i<n; i++)
+        out[i] = float2half(in[i]);
+}
+
+inline void cvt_store(bfloat16_t *out, const float *in, long int n)
+{
+    for (long int i=0; i<n; i++)
+        out[i] = float2bf16(in[i]);
+}
+
+/**
+ * @brief Load n values as float
+ */
+inline void cvt_load(float *out, const float *in, long int n)
+{
+    memcpy(out, in, sizeof(float)*n);
+}
+
+inline void cvt_load(float *out, const float16_t *in, long int n)
+{
+    long int i = 0;
+#if defined(__AVX512F__)
+    for (; i+16<=n; i+=16)
+    {
+        _mm512_storeu_ps(out+i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(in+i))));
+    }
+#endif
+#ifdef __F16C__
+    for (; i+8<=n; i+=8)
+    {
+        _mm256_storeu_ps(out+i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in+i))));
+    }
+#endif
+    for (; i<n; i++)
+        out[i] = half2float(in[i]);
+}
+
+inline void cvt_load(float *out, const bfloat16_t *in, long int n)
+{
+    long int i = 0;
+#ifdef __AVX2__
+    for (; i+8<=n; i+=8)
+    {
+        __m256i x = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(in+i))), 16);
+        _mm256_storeu_ps(out+i, _mm256_castsi256_ps(x));
+    }
+#endif
+    for (; i<n; i++)
+        out[i] = bf162float(in[i]);
+}
+
+/**
+ * @brief Accumulate n values into float, out += in
+ */
+inline void cvt_add(float *out, const float *in, long int n)
+{
+    for (long int i=0; i<n; i++)
+        out[i] += in[i];
+}
+
+inline void cvt_add(float *out, const float16_t *in, long int n)
+{
+    long int i = 0;
+#if defined(__AVX512F__)
+    for (; i+16<=n; i+=16)
+    {
+        __m512 x = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(in+i)));
+        _mm512_storeu_ps(out+i, _mm512_add_ps(_mm512_loadu_ps(out+i), x));
+    }
+#endif
+#ifdef __F16C__
+    for (; i+8<=n; i+=8)
+    {
+        __m256 x = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in+i)));
+        _mm256_storeu_ps(out+i, _mm256_add_ps(_mm256_loadu_ps(out+i), x));
+    }
+#endif
+    for (; i<n; i++)
+        out[i] += half2float(in[i]);
+}
+
+inline void cvt_add(float *out, const bfloat16_t *in, long int n)
+{
+    long int i = 0;
+#ifdef __AVX2__
+    for (; i+8<=n; i+=8)
+    {
+        __m256i x = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(in+i))), 16);
+        _mm256_storeu_ps(out+i, _mm256_add_ps(_mm256_loadu_ps(out+i), _mm256_castsi256_ps(x)));
+    }
+#endif
+    for (; i<n; i++)
+        out[i] += bf162float(in[i]);
+}
+
+#endif /* FLOAT16_H_ */
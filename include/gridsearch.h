@@ -11,6 +11,7 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
 
 #include "archivelite.h"
 
@@ -56,6 +57,20 @@ namespace Pulsar
 
             outfile.close();
         }
+        /** write the profiles to store, which holds nsubint*nchan*nbin floats, and free them until load */
+        void unload(float *store)
+        {
+            std::copy(profiles.begin(), profiles.end(), store);
+            vector<float>().swap(profiles);
+        }
+        void load(const float *store)
+        {
+            profiles.assign(store, store+nsubint*nchan*nbin);
+        }
+        void close()
+        {
+            vector<float>().swap(profiles);
+        }
     public:
         float get_chisq(vector<float> &pro);
         void get_snr_width();
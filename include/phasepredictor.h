@@ -0,0 +1,70 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-13 10:05:21
+ * @modify date 2020-11-14 15:32:08
+ * @desc spin phase of a subint, expanded about its start so that the samples are evaluated in double
+ */
+
+#ifndef PHASEPREDICTOR_H_
+#define PHASEPREDICTOR_H_
+
+#include <vector>
+
+#include "mjd.h"
+#include "t2predictor.h"
+
+using namespace std;
+
+/** length of the quadratic pieces interpolating a tempo2 predictor (s) */
+#define PHASE_PIECE 0.5
+
+namespace Pulsar
+{
+    /**
+     * @brief Phase of a subint as quadratic pieces in the time t since its start, piece p covers [p*tpiece, (p+1)*tpiece),
+     *        phi0 counts the turns from the integer turn before the start, only the fit needs long double, the turns
+     *        within a subint are small enough for double. phi(t) = f0*t+0.5*f1*t^2 about the reference epoch is exact
+     *        in one piece, a tempo2 predictor is interpolated through three points of each piece
+     */
+    class PhasePredictor
+    {
+    public:
+        PhasePredictor();
+        ~PhasePredictor();
+        void fit(MJD start, MJD &ref_epoch, double f0, double f1);
+        void fit(const T2Predictor &t2pred, MJD start, double tspan, double freq);
+        /** phase in turns at t seconds after the start, phase(0) is in [0,1) */
+        double get_phase(double t) const
+        {
+            long int p = get_piece(t);
+            t -= p*tpiece;
+            return phi0[p] + (f[p] + 0.5*fdot[p]*t)*t;
+        }
+        double get_ffold(double t) const
+        {
+            long int p = get_piece(t);
+            t -= p*tpiece;
+            return f[p] + fdot[p]*t;
+        }
+        void get_bins(double *frac, int *ibin, long int n, double t0, double dt, int nbin) const;
+    private:
+        long int get_piece(double t) const
+        {
+            if (phi0.size() == 1) return 0;
+            long int p = floor(t/tpiece);
+            p = p<0 ? 0:p;
+            p = p>=(long int)phi0.size() ? phi0.size()-1:p;
+            return p;
+        }
+    public:
+        /** length of the pieces (s), 0 for a single piece */
+        double tpiece;
+        /** phase, spin frequency and its derivative at the start of each piece */
+        vector<double> phi0;
+        vector<double> f;
+        vector<double> fdot;
+    };
+}
+
+#endif /* PHASEPREDICTOR_H_ */
@@ -0,0 +1,49 @@
+/*
+ * preprocess.h
+ *
+ *  Created on: Nov 5, 2020
+ *      Author: ypmen
+ */
+
+#ifndef PREPROCESS_H_
+#define PREPROCESS_H_
+
+#include <vector>
+#include <utility>
+
+#include "databuffer.h"
+#include "equalize.h"
+#include "arena.h"
+
+using namespace std;
+
+/**
+ * @brief Downsample, equalize and zap in two passes over the chunk:
+ *        pass 1 downsamples in cache-sized tiles and accumulates the channel statistics,
+ *        pass 2 normalizes and applies the channel mask
+ */
+class Preprocess : public DataBuffer<float>
+{
+public:
+    Preprocess();
+    Preprocess(const Preprocess &preprocess);
+    Preprocess & operator=(const Preprocess &preprocess);
+    Preprocess(int tds, int fds);
+    ~Preprocess();
+    void prepare(DataBuffer<float> &databuffer);
+    void run(DataBuffer<float> &databuffer);
+    void zap(const vector<pair<double, double>> &zaplist);
+public:
+    int td;
+    int fd;
+    /** channel mask, 0 for zapped channels */
+    vector<int> weights;
+    vector<double> chmean;
+    vector<double> chstd;
+    ChannelStatistics stats;
+private:
+    /** per-chunk temporaries of run */
+    Arena arena;
+};
+
+#endif /* PREPROCESS_H_ */
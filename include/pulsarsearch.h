@@ -17,8 +17,7 @@
 
 #include "subdedispersion.h"
 #include "databuffer.h"
-#include "downsample.h"
-#include "equalize.h"
+#include "preprocess.h"
 #include "rfi.h"
 
 using namespace std;
@@ -31,10 +30,10 @@ public:
     ~PulsarSearch();
     void prepare(DataBuffer<float> &databuffer);
     void run(DataBuffer<float> &databuffer);
+    size_t get_memory(const DataBuffer<float> &databuffer) const;
 public:
     //components
-    Downsample downsample;
-    Equalize equalize;
+    Preprocess preprocess;
     RFI rfi;
     RealTime::SubbandDedispersion dedisp;
 
@@ -42,6 +41,10 @@ public:
     int td;
     int fd;
 
+    //equalize
+    ChannelStatistics::Mode eqmode;
+    double eqtime;
+
     //rfi
     vector<pair<double, double>> zaplist;
     vector<vector<string>> rfilist;
@@ -50,12 +53,17 @@ public:
     double bandlimitKT;
     float threKadaneT;
     float threKadaneF;
+    float threSK;
     float threMask;
 
     //dedispere
     double dms;
     double ddm;
     long int ndm;
+    RealTime::Precision precision;
+
+    //baseline
+    double baseline;
 
     int ibeam;
     string rootname;
@@ -63,5 +71,6 @@ public:
 };
 
 void plan(variables_map &vm, vector<PulsarSearch> &search);
+long int plan_memory(vector<PulsarSearch> &search, vector<vector<PulsarSearch>> &passes, DataBuffer<float> &databuffer, double maxmemory, bool verbose=true);
 
 #endif /* PULSARSEARCH */
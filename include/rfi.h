@@ -12,6 +12,7 @@
 #include <utility>
 
 #include "databuffer.h"
+#include "arena.h"
 
 using namespace std;
 
@@ -29,8 +30,21 @@ public:
     bool mask(DataBuffer<float> &databuffer, float threRFI2, int td, int fd);
     bool kadaneF(DataBuffer<float> &databuffer, float threRFI2, double widthlimit, int td, int fd);
     bool kadaneT(DataBuffer<float> &databuffer, float threRFI2, double bandlimit, int td, int fd);
+    bool sk(DataBuffer<float> &databuffer, const vector<double> &chmean, const vector<double> &chstd, float threSK, int td, int fd);
 public:
     vector<int> weights;
+private:
+    void downsample(DataBuffer<float> &databuffer, int td, int fd, float *vmin=NULL, float *vmax=NULL);
+    /**
+     * downsample (td_ds, fd_ds) of buffer shared by mask, kadaneF and kadaneT,
+     * they keep it up to date when they modify buffer in place, other stages invalidate it
+     */
+    bool ds_valid;
+    int td_ds;
+    int fd_ds;
+    vector<float> buffer_ds;
+    /** temporaries of zdot, mask and sk, reset at the start of each */
+    Arena arena;
 };
 
 
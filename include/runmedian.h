@@ -0,0 +1,57 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-10 15:21:07
+ * @modify date 2020-11-10 15:21:07
+ * @desc sliding window median with two indexed heaps in fixed arrays, no allocation after resize
+ */
+
+#ifndef RUNMEDIAN_H_
+#define RUNMEDIAN_H_
+
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Median of a set of at most capacity values, each value is kept in a slot (0 <= slot < capacity),
+ *        the lower half is a max-heap and the upper half a min-heap, insert and remove are O(log capacity)
+ */
+template <typename T>
+class MedianHeap
+{
+public:
+    MedianHeap();
+    MedianHeap(int cap);
+    ~MedianHeap();
+    void resize(int cap);
+    void clear();
+    void insert(int slot, T val);
+    void remove(int slot);
+    T median() const;
+    int size() const {return nlo+nhi;}
+    void run(const T *data, T *datMedian, long int n, int w);
+private:
+    void siftup_lo(int p);
+    void siftdown_lo(int p);
+    void siftup_hi(int p);
+    void siftdown_hi(int p);
+    void push_lo(int slot);
+    void push_hi(int slot);
+    int pop_lo();
+    int pop_hi();
+    void rebalance();
+public:
+    int capacity;
+private:
+    /** value of each slot */
+    vector<T> value;
+    /** heap position of each slot, p>=0 in lo, -p-1 in hi */
+    vector<int> where;
+    vector<int> lo;
+    vector<int> hi;
+    int nlo;
+    int nhi;
+};
+
+#endif /* RUNMEDIAN_H_ */
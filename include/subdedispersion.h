@@ -12,6 +12,7 @@
 #include <fstream>
 #include <vector>
 #include "databuffer.h"
+#include "float16.h"
 #include "dedisperse.h"
 
 using namespace std;
@@ -20,13 +21,44 @@ using namespace std;
 
 namespace RealTime
 {
+    /** storage precision of the dedispersion history */
+    enum Precision{FP32, FP16, BF16};
+
+    /**
+     * @brief Channel-major circular history of nrows rows with nsamples samples per row,
+     *        stored in float, half or bfloat16 and read back as float
+     */
+    class History
+    {
+    public:
+        History();
+        ~History();
+        void resize(long int nrows, long int ns);
+        void push(long int irow, const float *in, long int ns);
+        void advance(long int ns);
+        void add(float *out, long int irow, long int t, long int ns) const;
+        void copy(float *out, long int irow, long int t, long int ns) const;
+        static size_t sizeof_sample(enum Precision p)
+        {
+            return p==FP32 ? sizeof(float) : sizeof(uint16_t);
+        }
+    public:
+        enum Precision precision;
+        long int nsamples;
+        /** physical index of the oldest sample */
+        long int head;
+        vector<float> buffer;
+        vector<float16_t> buffer16;
+        vector<bfloat16_t> bufferbf16;
+    };
+
     class Subband
     {
     public:
         Subband();
         ~Subband();
         void prepare();
-        void run(vector<float> &data);
+        void run(vector<float> &data, const vector<int> &mask);
         void get_subdata(vector<float> &subdata, int idm) const;
         void get_timdata(vector<float> &timdata, int idm) const;
         void dumpsubdata(const string &rootname, int idm) const
@@ -74,8 +106,10 @@ namespace RealTime
     public:
         long int counter;
         vector<int> mxdelayn;
-        vector<float> buffer;
-        vector<float> bufferT;
+        enum Precision precision;
+        History bufferT;
+        /** number of trailing zero samples in each row of bufferT */
+        vector<long int> zerolen;
         vector<float> buffertim;
     };
 
@@ -86,6 +120,7 @@ namespace RealTime
         ~SubbandDedispersion();
         void prepare(DataBuffer<float> &databuffer);
         void run(DataBuffer<float> &databuffer, long int ns);
+        size_t get_memory(const DataBuffer<float> &databuffer) const;
         void preparedump();
         void rundump();
         void get_subdata(vector<float> &subdata, int idm) const
@@ -114,6 +149,8 @@ namespace RealTime
         double dms;
         double ddm;
         int ndm;
+        /** width (s) of the running median subtracted from the dumped time series, 0 for none */
+        double baseline;
     public:
         float mean;
         float var;
@@ -128,10 +165,16 @@ namespace RealTime
         vector<int> fmap;
         vector<int> fcnt;
         vector<double> frefsub;
-        vector<float> buffer;
-        vector<float> bufferT;
+        enum Precision precision;
+        History bufferT;
+        /** number of trailing zero samples in each row of bufferT */
+        vector<long int> zerolen;
+        vector<float> bufferchunk;
         vector<float> buffersub;
-        vector<float> buffersubT;
+        /** 0 for rows of buffersub that get no channel in this chunk */
+        vector<int> submask;
+        /** (ndm, ndump) time series with the baseline removed */
+        vector<float> buffertimbl;
         int nsub;
         Subband sub;
     public:
@@ -0,0 +1,62 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-14 15:32:08
+ * @modify date 2020-11-14 15:32:08
+ * @desc tempo2 predictor (ChebyModelSet), pulse phase and frequency of a known pulsar from its ephemeris
+ */
+
+#ifndef T2PREDICTOR_H_
+#define T2PREDICTOR_H_
+
+#include <string>
+#include <vector>
+
+#include "mjd.h"
+
+using namespace std;
+
+namespace Pulsar
+{
+    /**
+     * @brief One segment of the predictor, phase = sum c[ix*ny+iy]*T_ix(x)*T_iy(y)+dispersion_constant/freq^2,
+     *        x and y are mjd and freq mapped to [-1,1], the first term of each dimension is halved
+     */
+    struct ChebyModel
+    {
+        long double mjd_start;
+        long double mjd_end;
+        long double freq_start;
+        long double freq_end;
+        long double dispersion_constant;
+        int nx;
+        int ny;
+        /** (nx, ny) */
+        vector<long double> coeff;
+        /** d/dx of coeff, (nx, ny) */
+        vector<long double> dcoeff;
+    };
+
+    class T2Predictor
+    {
+    public:
+        T2Predictor();
+        ~T2Predictor();
+        bool load(const string &fname);
+        bool load(const vector<string> &lines);
+        bool empty() const {return models.empty();}
+        long double get_phase(MJD mjd, long double freq) const;
+        long double get_ffold(MJD mjd, long double freq) const;
+    private:
+        const ChebyModel & get_model(long double mjd) const;
+        static long double evaluate(const vector<long double> &c, int nx, int ny, long double x, long double y);
+    public:
+        string psrname;
+        /** the predictor as read, written to the T2PREDICT table of the archive */
+        vector<string> text;
+    private:
+        vector<ChebyModel> models;
+    };
+}
+
+#endif /* T2PREDICTOR_H_ */
@@ -94,6 +94,7 @@ template <typename T>
 void runMedian2(T *data, T *datMedian, long int size, int w);
 template <typename T>
 void runMedian3(T *data, T *datMedian, long int size, int w);
+void runMedianBatch(const float *data, float *datMedian, long int nseries, long int size, int w, int ds=1);
 
 template <typename T>
 void transpose(T *out, T *in, int m, int n);
@@ -147,6 +148,29 @@ inline bool get_inverse_matrix4x4(const double m[4][4], double invOut[4][4])
  */
 bool get_inverse_matrix3x3(const double m[3][3], double invOut[3][3]);
 
+/**
+ * @brief Cholesky factorization in place of a symmetric positive definite matrix whose
+ *        nonzeros lie within p of the diagonal cyclically, a[i*n+j] != 0 only if (i-j) mod n <= p
+ *        or (j-i) mod n <= p, rows i < n-p of L start at column i-p and the last p rows are full
+ * 
+ * @param a: shape = (n, n), the lower triangle is overwritten by L, the upper triangle is not touched
+ * @param n
+ * @param p: half bandwidth
+ * @return false if not positive definite
+ */
+bool cholesky_cyclic_band(float *a, int n, int p);
+
+/**
+ * @brief Solve a x = b with the factor of cholesky_cyclic_band
+ * 
+ * @param a: factor, shape = (n, n)
+ * @param n
+ * @param p: half bandwidth
+ * @param b: right hand sides, shape = (n, nrhs), overwritten by x
+ * @param nrhs
+ */
+void cholesky_solve_cyclic_band(const float *a, int n, int p, float *b, long int nrhs);
+
 /**
  * @brief Get the error from chisq matrix
  * 
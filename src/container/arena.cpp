@@ -0,0 +1,107 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-12 10:26:41
+ * @modify date 2020-11-12 10:26:41
+ * @desc scratch memory for the temporaries of a pipeline stage, reused from chunk to chunk
+ */
+
+#include <stdint.h>
+
+#include "arena.h"
+
+Arena::Arena()
+{
+    offset = 0;
+    used = 0;
+    peak = 0;
+}
+
+Arena::Arena(const Arena &)
+{
+    offset = 0;
+    used = 0;
+    peak = 0;
+}
+
+/** the scratch memory is not shared, the arena keeps its own blocks */
+Arena & Arena::operator=(const Arena &)
+{
+    return *this;
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+void Arena::grow(size_t nbytes)
+{
+    /** room to align the first array */
+    blocks.push_back(new char[nbytes+ARENA_ALIGN]);
+    sizes.push_back(nbytes);
+
+    char *p = blocks.back();
+    offset = (ARENA_ALIGN-(uintptr_t)p%ARENA_ALIGN)%ARENA_ALIGN;
+    sizes.back() += offset;
+}
+
+void *Arena::allocate(size_t nbytes)
+{
+    nbytes = (nbytes+ARENA_ALIGN-1)/ARENA_ALIGN*ARENA_ALIGN;
+
+    if (blocks.empty() or offset+nbytes > sizes.back())
+    {
+        size_t size = blocks.empty() ? ARENA_BLOCK : 2*sizes.back();
+        grow(max(size, nbytes));
+    }
+
+    char *p = blocks.back()+offset;
+    offset += nbytes;
+    used += nbytes;
+    peak = max(peak, used);
+
+    return p;
+}
+
+/**
+ * @brief Free all arrays handed out since the last reset, they must not be used afterwards
+ */
+void Arena::reset()
+{
+    if (blocks.size() > 1)
+    {
+        /** one block that holds the whole chunk next time */
+        release();
+        grow(peak);
+    }
+
+    if (!blocks.empty())
+        offset = (ARENA_ALIGN-(uintptr_t)blocks.back()%ARENA_ALIGN)%ARENA_ALIGN;
+    used = 0;
+}
+
+/**
+ * @brief Return the memory to the heap
+ */
+void Arena::release()
+{
+    for (auto b=blocks.begin(); b!=blocks.end(); ++b)
+    {
+        delete [] *b;
+    }
+    blocks.clear();
+    sizes.clear();
+    offset = 0;
+    used = 0;
+}
+
+size_t Arena::capacity() const
+{
+    size_t size = 0;
+    for (auto s=sizes.begin(); s!=sizes.end(); ++s)
+    {
+        size += *s;
+    }
+    return size;
+}
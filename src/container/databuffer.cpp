@@ -35,6 +35,7 @@ DataBuffer<T>::DataBuffer(const DataBuffer<T> &databuffer)
     tsamp = databuffer.tsamp;
     nchans = databuffer.nchans;
     frequencies = databuffer.frequencies;
+    chmask = databuffer.chmask;
     buffer = databuffer.buffer;
 }
 
@@ -47,6 +48,7 @@ DataBuffer<T> & DataBuffer<T>::operator=(const DataBuffer<T> &databuffer)
     tsamp = databuffer.tsamp;
     nchans = databuffer.nchans;
     frequencies = databuffer.frequencies;
+    chmask = databuffer.chmask;
     buffer = databuffer.buffer;
 
     return *this;    
@@ -80,6 +82,7 @@ template <typename T>
 void DataBuffer<T>::run(DataBuffer<T> &databuffer)
 {
     buffer = databuffer.buffer;
+    chmask = databuffer.chmask;
 
     counter += nsamples;
 };
@@ -144,6 +147,7 @@ void DataBuffer<T>::resize(long int ns, int nc)
     nchans = nc;
     buffer.resize(nsamples*nchans, 0.);
     frequencies.resize(nchans, 0.);
+    chmask.assign(nchans, 1);
 }
 
 template <typename T>
@@ -168,6 +172,29 @@ void DataBuffer<T>::get_mean_rms(vector<T> &mean, vector<T> &var)
     }
 }
 
+/**
+ * @brief Get the contiguous ranges [first, second) of unmasked channels
+ */
+template <typename T>
+void DataBuffer<T>::get_chranges(vector<pair<long int, long int>> &ranges) const
+{
+    ranges.clear();
+    if (chmask.empty())
+    {
+        ranges.push_back(pair<long int, long int>(0, nchans));
+        return;
+    }
+
+    long int j = 0;
+    while (j < nchans)
+    {
+        while (j < nchans and !chmask[j]) j++;
+        long int first = j;
+        while (j < nchans and chmask[j]) j++;
+        if (j > first) ranges.push_back(pair<long int, long int>(first, j));
+    }
+}
+
 template class DataBuffer<char>;
 template class DataBuffer<unsigned char>;
 template class DataBuffer<float>;
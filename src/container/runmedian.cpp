@@ -0,0 +1,262 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-10 15:21:07
+ * @modify date 2020-11-10 15:21:07
+ * @desc sliding window median with two indexed heaps in fixed arrays, no allocation after resize
+ */
+
+#include <assert.h>
+
+#include "runmedian.h"
+
+template <typename T>
+MedianHeap<T>::MedianHeap()
+{
+    capacity = 0;
+    nlo = 0;
+    nhi = 0;
+}
+
+template <typename T>
+MedianHeap<T>::MedianHeap(int cap)
+{
+    resize(cap);
+}
+
+template <typename T>
+MedianHeap<T>::~MedianHeap(){}
+
+template <typename T>
+void MedianHeap<T>::resize(int cap)
+{
+    capacity = cap;
+    value.resize(capacity, 0);
+    where.resize(capacity, 0);
+    lo.resize(capacity/2+1, 0);
+    hi.resize(capacity/2+1, 0);
+    nlo = 0;
+    nhi = 0;
+}
+
+template <typename T>
+void MedianHeap<T>::clear()
+{
+    nlo = 0;
+    nhi = 0;
+}
+
+/** lo is a max-heap */
+template <typename T>
+void MedianHeap<T>::siftup_lo(int p)
+{
+    int s = lo[p];
+    while (p > 0)
+    {
+        int q = (p-1)/2;
+        if (!(value[lo[q]] < value[s])) break;
+        lo[p] = lo[q];
+        where[lo[p]] = p;
+        p = q;
+    }
+    lo[p] = s;
+    where[s] = p;
+}
+
+template <typename T>
+void MedianHeap<T>::siftdown_lo(int p)
+{
+    int s = lo[p];
+    while (true)
+    {
+        int c = 2*p+1;
+        if (c >= nlo) break;
+        if (c+1 < nlo && value[lo[c]] < value[lo[c+1]]) c++;
+        if (!(value[s] < value[lo[c]])) break;
+        lo[p] = lo[c];
+        where[lo[p]] = p;
+        p = c;
+    }
+    lo[p] = s;
+    where[s] = p;
+}
+
+/** hi is a min-heap */
+template <typename T>
+void MedianHeap<T>::siftup_hi(int p)
+{
+    int s = hi[p];
+    while (p > 0)
+    {
+        int q = (p-1)/2;
+        if (!(value[s] < value[hi[q]])) break;
+        hi[p] = hi[q];
+        where[hi[p]] = -p-1;
+        p = q;
+    }
+    hi[p] = s;
+    where[s] = -p-1;
+}
+
+template <typename T>
+void MedianHeap<T>::siftdown_hi(int p)
+{
+    int s = hi[p];
+    while (true)
+    {
+        int c = 2*p+1;
+        if (c >= nhi) break;
+        if (c+1 < nhi && value[hi[c+1]] < value[hi[c]]) c++;
+        if (!(value[hi[c]] < value[s])) break;
+        hi[p] = hi[c];
+        where[hi[p]] = -p-1;
+        p = c;
+    }
+    hi[p] = s;
+    where[s] = -p-1;
+}
+
+template <typename T>
+void MedianHeap<T>::push_lo(int slot)
+{
+    lo[nlo] = slot;
+    siftup_lo(nlo++);
+}
+
+template <typename T>
+void MedianHeap<T>::push_hi(int slot)
+{
+    hi[nhi] = slot;
+    siftup_hi(nhi++);
+}
+
+template <typename T>
+int MedianHeap<T>::pop_lo()
+{
+    int s = lo[0];
+    if (--nlo > 0)
+    {
+        lo[0] = lo[nlo];
+        siftdown_lo(0);
+    }
+    return s;
+}
+
+template <typename T>
+int MedianHeap<T>::pop_hi()
+{
+    int s = hi[0];
+    if (--nhi > 0)
+    {
+        hi[0] = hi[nhi];
+        siftdown_hi(0);
+    }
+    return s;
+}
+
+/** keep nlo == nhi or nlo == nhi+1 */
+template <typename T>
+void MedianHeap<T>::rebalance()
+{
+    if (nlo > nhi+1)
+        push_hi(pop_lo());
+    else if (nhi > nlo)
+        push_lo(pop_hi());
+}
+
+template <typename T>
+void MedianHeap<T>::insert(int slot, T val)
+{
+    assert(nlo+nhi < capacity);
+
+    value[slot] = val;
+    if (nlo == 0 || !(value[lo[0]] < val))
+        push_lo(slot);
+    else
+        push_hi(slot);
+
+    rebalance();
+}
+
+template <typename T>
+void MedianHeap<T>::remove(int slot)
+{
+    /** the last element of the heap takes the place of slot and is sifted either way */
+    int p = where[slot];
+    if (p >= 0)
+    {
+        if (--nlo > p)
+        {
+            int s = lo[nlo];
+            lo[p] = s;
+            siftup_lo(p);
+            siftdown_lo(where[s]);
+        }
+    }
+    else
+    {
+        p = -p-1;
+        if (--nhi > p)
+        {
+            int s = hi[nhi];
+            hi[p] = s;
+            siftup_hi(p);
+            siftdown_hi(-where[s]-1);
+        }
+    }
+
+    rebalance();
+}
+
+/**
+ * @brief The middle value, or the mean of the two middle values for an even count
+ */
+template <typename T>
+T MedianHeap<T>::median() const
+{
+    if (nlo > nhi)
+        return value[lo[0]];
+    else
+        return (value[lo[0]]+value[hi[0]])/2;
+}
+
+/**
+ * @brief Running median of data with the window [i-w/2, i+(w+1)/2), truncated at both ends
+ *
+ * @param data
+ * @param datMedian
+ * @param n length of data
+ * @param w window width, capped at n, the heap grows to w if it is smaller
+ */
+template <typename T>
+void MedianHeap<T>::run(const T *data, T *datMedian, long int n, int w)
+{
+    w = w > n ? n : w;
+    w = w < 1 ? 1 : w;
+    if (w > capacity) resize(w);
+    clear();
+
+    long int a = -(w/2);
+    long int b = (w+1)/2;
+
+    for (long int i=0; i<b; i++)
+    {
+        insert(i%capacity, data[i]);
+    }
+    datMedian[0] = median();
+
+    for (long int i=1; i<n; i++)
+    {
+        a++;
+        b++;
+        if (a > 0)
+            remove((a-1)%capacity);
+        if (b <= n)
+            insert((b-1)%capacity, data[b-1]);
+
+        datMedian[i] = median();
+    }
+}
+
+template class MedianHeap<float>;
+template class MedianHeap<double>;
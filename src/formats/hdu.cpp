@@ -492,7 +492,8 @@ bool PsrparamHDU::unload(fitsfile *fptr)
 
 	for (long int l=0; l<text.size(); l++)
 	{
-		fits_write_col(fptr, TSTRING, colnum, l+1, 1, 1, &(text[l]), &status);
+		char *line = (char *)text[l].c_str();
+		fits_write_col(fptr, TSTRING, colnum, l+1, 1, 1, &line, &status);
 	}
 
 	if (status)
@@ -617,7 +618,8 @@ bool T2predictHDU::unload(fitsfile *fptr)
 
 	for (long int l=0; l<text.size(); l++)
 	{
-		fits_write_col(fptr, TSTRING, colnum, l+1, 1, 1, &(text[l]), &status);
+		char *line = (char *)text[l].c_str();
+		fits_write_col(fptr, TSTRING, colnum, l+1, 1, 1, &line, &status);
 	}
 
 	if (status)
@@ -102,6 +102,16 @@ void ArchiveWriter::prepare(Pulsar::ArchiveLite &arch, Pulsar::GridSearch &grid)
 
     fits.parse_template(template_file);
     fits.primary.unload(fits.fptr);
+    if (!psrparam.empty())
+    {
+        fits.psrparam.text = psrparam;
+        fits.psrparam.unload(fits.fptr);
+    }
+    if (!t2predict.empty())
+    {
+        fits.t2predict.text = t2predict;
+        fits.t2predict.unload(fits.fptr);
+    }
     fits.subint.unload_header(fits.fptr);
 
     it.mode = Integration::FOLD;
@@ -7,11 +7,174 @@
 
 #include <string.h>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "dedisperse.h"
 #include "downsample.h"
 
 using namespace std;
 
+#ifdef __AVX2__
+/**
+ * @brief Reduce the accumulators of 8 output channels to the 8 channel sums, in channel order
+ */
+template <int FD>
+static inline __m256 fscrunch8(const __m256 *acc);
+
+template <>
+inline __m256 fscrunch8<1>(const __m256 *acc)
+{
+    return acc[0];
+}
+
+template <>
+inline __m256 fscrunch8<2>(const __m256 *acc)
+{
+    __m256 h = _mm256_hadd_ps(acc[0], acc[1]);
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), 0xD8));
+}
+
+template <>
+inline __m256 fscrunch8<4>(const __m256 *acc)
+{
+    __m256 h01 = _mm256_hadd_ps(acc[0], acc[1]);
+    __m256 h23 = _mm256_hadd_ps(acc[2], acc[3]);
+    __m256 h = _mm256_hadd_ps(h01, h23);
+    return _mm256_permutevar8x32_ps(h, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+template <>
+inline __m256 fscrunch8<8>(const __m256 *acc)
+{
+    __m256 h0 = _mm256_hadd_ps(acc[0], acc[1]);
+    __m256 h1 = _mm256_hadd_ps(acc[2], acc[3]);
+    __m256 h2 = _mm256_hadd_ps(acc[4], acc[5]);
+    __m256 h3 = _mm256_hadd_ps(acc[6], acc[7]);
+    __m256 g0 = _mm256_hadd_ps(h0, h1);
+    __m256 g1 = _mm256_hadd_ps(h2, h3);
+    return _mm256_add_ps(_mm256_permute2f128_ps(g0, g1, 0x20), _mm256_permute2f128_ps(g0, g1, 0x31));
+}
+
+/** fd=16 is pre-added to 8 accumulators */
+template <>
+inline __m256 fscrunch8<16>(const __m256 *acc)
+{
+    return fscrunch8<8>(acc);
+}
+#endif
+
+/**
+ * @brief Downsample kernel with compile-time td and fd,
+ *        TD input rows are summed in registers and reduced across frequency once per 8 output channels
+ */
+template <int TD, int FD>
+static void downsample_kernel(float *out, const float *in, long int nsamples_ds, long int nchans_ds, long int nchans, bool parallel)
+{
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) if(parallel)
+#endif
+    for (long int i=0; i<nsamples_ds; i++)
+    {
+        const float *pin = in+i*TD*nchans;
+        float *pout = out+i*nchans_ds;
+
+        long int j = 0;
+#ifdef __AVX2__
+        const int NA = FD<8 ? FD:8;
+        const int NV = FD/NA;
+        for (; j+8<=nchans_ds; j+=8)
+        {
+            __m256 acc[NA];
+            for (int a=0; a<NA; a++)
+                acc[a] = _mm256_setzero_ps();
+
+            for (int n=0; n<TD; n++)
+            {
+                const float *p = pin+n*nchans+j*FD;
+                for (int a=0; a<NA; a++)
+                {
+                    for (int v=0; v<NV; v++)
+                    {
+                        acc[a] = _mm256_add_ps(acc[a], _mm256_loadu_ps(p+(a*NV+v)*8));
+                    }
+                }
+            }
+
+            _mm256_storeu_ps(pout+j, fscrunch8<FD>(acc));
+        }
+#endif
+        for (long int jj=j; jj<nchans_ds; jj++)
+            pout[jj] = 0.;
+
+        for (int n=0; n<TD; n++)
+        {
+            for (long int jj=j; jj<nchans_ds; jj++)
+            {
+                for (int k=0; k<FD; k++)
+                {
+                    pout[jj] += pin[n*nchans+jj*FD+k];
+                }
+            }
+        }
+    }
+}
+
+template <int FD>
+static bool downsample_dispatch(float *out, const float *in, long int nsamples_ds, long int nchans_ds, long int nchans, int td, bool parallel)
+{
+    switch (td)
+    {
+    case 1: downsample_kernel<1, FD>(out, in, nsamples_ds, nchans_ds, nchans, parallel); return true;
+    case 2: downsample_kernel<2, FD>(out, in, nsamples_ds, nchans_ds, nchans, parallel); return true;
+    case 4: downsample_kernel<4, FD>(out, in, nsamples_ds, nchans_ds, nchans, parallel); return true;
+    case 8: downsample_kernel<8, FD>(out, in, nsamples_ds, nchans_ds, nchans, parallel); return true;
+    case 16: downsample_kernel<16, FD>(out, in, nsamples_ds, nchans_ds, nchans, parallel); return true;
+    default: return false;
+    }
+}
+
+void downsample_sum(float *out, const float *in, long int nsamples, long int nchans, int td, int fd, bool parallel)
+{
+    long int nsamples_ds = nsamples/td;
+    long int nchans_ds = nchans/fd;
+
+    bool done = false;
+    switch (fd)
+    {
+    case 1: done = downsample_dispatch<1>(out, in, nsamples_ds, nchans_ds, nchans, td, parallel); break;
+    case 2: done = downsample_dispatch<2>(out, in, nsamples_ds, nchans_ds, nchans, td, parallel); break;
+    case 4: done = downsample_dispatch<4>(out, in, nsamples_ds, nchans_ds, nchans, td, parallel); break;
+    case 8: done = downsample_dispatch<8>(out, in, nsamples_ds, nchans_ds, nchans, td, parallel); break;
+    case 16: done = downsample_dispatch<16>(out, in, nsamples_ds, nchans_ds, nchans, td, parallel); break;
+    default: break;
+    }
+
+    if (done) return;
+
+    /** generic td, fd */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) if(parallel)
+#endif
+    for (long int i=0; i<nsamples_ds; i++)
+    {
+        for (long int j=0; j<nchans_ds; j++)
+            out[i*nchans_ds+j] = 0.;
+
+        for (long int n=0; n<td; n++)
+        {
+            for (long int k=0; k<fd; k++)
+            {
+                for (long int j=0; j<nchans_ds; j++)
+                {
+                    out[i*nchans_ds+j] += in[(i*td+n)*nchans+j*fd+k];
+                }
+            }
+        }
+    }
+}
+
 Downsample::Downsample()
 {
     td = 1;
@@ -65,25 +228,8 @@ void Downsample::prepare(DataBuffer<float> &databuffer)
 
 void Downsample::run(DataBuffer<float> &databuffer)
 {
-    fill(buffer.begin(), buffer.end(), 0.);
+    downsample_sum(&buffer[0], &databuffer.buffer[0], nsamples*td, databuffer.nchans, td, fd);
 
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads)
-#endif
-    for (long int i=0; i<nsamples; i++)
-    {
-        for (long int n=0; n<td; n++)
-        {
-            for (long int k=0; k<fd; k++)
-            {
-                for (long int j=0; j<nchans; j++)
-                {
-                    buffer[i*nchans+j] += databuffer.buffer[(i*td+n)*databuffer.nchans+j*fd+k];
-                }
-            }
-        }
-    }
-    
     equalized = false;
     counter += nsamples;
 }
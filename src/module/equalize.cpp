@@ -13,14 +13,247 @@
 
 using namespace std;
 
+ChannelStatistics::ChannelStatistics()
+{
+    mode = CHUNK;
+    timescale = 10.;
+
+    nchans = 0;
+    tsamp = 0.;
+    nupdate = 0;
+    nwindow = 1;
+}
+
+ChannelStatistics::~ChannelStatistics(){}
+
+/**
+ * @brief Reset the estimators
+ *
+ * @param nchans: number of channels
+ * @param nsamples: number of samples per chunk
+ * @param tsamp: sampling time (s)
+ */
+void ChannelStatistics::prepare(long int nc, long int nsamples, double ts)
+{
+    nchans = nc;
+    tsamp = ts;
+    nupdate = 0;
+
+    mean.resize(nchans, 0.);
+    power.resize(nchans, 0.);
+
+    nwindow = 1;
+    if (mode == WINDOW)
+    {
+        nwindow = round(timescale/(nsamples*tsamp));
+        nwindow = nwindow>1 ? nwindow:1;
+    }
+    winsum.resize(nwindow*nchans, 0.);
+    winsum2.resize(nwindow*nchans, 0.);
+    winn.resize(nwindow, 0);
+
+    if (mode == ROBUST)
+    {
+        median.resize(nchans, 0.);
+        mad.resize(nchans, 0.);
+    }
+}
+
+/**
+ * @brief Update with the per-channel sum and sum of squares of the n samples of one chunk (CHUNK, EWMA, WINDOW)
+ */
+void ChannelStatistics::update(const double *chsum, const double *chsum2, long int n)
+{
+    switch (mode)
+    {
+    case EWMA:
+    {
+        double alpha = nupdate==0 ? 1.:1.-exp(-n*tsamp/timescale);
+        for (long int j=0; j<nchans; j++)
+        {
+            mean[j] = (1.-alpha)*mean[j]+alpha*chsum[j]/n;
+            power[j] = (1.-alpha)*power[j]+alpha*chsum2[j]/n;
+        }
+    }; break;
+    case WINDOW:
+    {
+        long int k = nupdate%nwindow;
+        memcpy(&winsum[k*nchans], chsum, sizeof(double)*nchans);
+        memcpy(&winsum2[k*nchans], chsum2, sizeof(double)*nchans);
+        winn[k] = n;
+
+        long int ntot = 0;
+        fill(mean.begin(), mean.end(), 0.);
+        fill(power.begin(), power.end(), 0.);
+        for (long int m=0; m<nwindow; m++)
+        {
+            ntot += winn[m];
+            for (long int j=0; j<nchans; j++)
+            {
+                mean[j] += winsum[m*nchans+j];
+                power[j] += winsum2[m*nchans+j];
+            }
+        }
+        for (long int j=0; j<nchans; j++)
+        {
+            mean[j] /= ntot;
+            power[j] /= ntot;
+        }
+    }; break;
+    default:
+    {
+        for (long int j=0; j<nchans; j++)
+        {
+            mean[j] = chsum[j]/n;
+            power[j] = chsum2[j]/n;
+        }
+    }; break;
+    }
+
+    nupdate++;
+}
+
+/**
+ * @brief Exact median and MAD of channel j of n time-major samples, chdata holds n floats,
+ *        a constant channel needs no selection
+ */
+static void measure_robust(const float *data, long int n, long int nchans, long int j, float *chdata, float &median, float &mad)
+{
+    bool constant = true;
+    for (long int i=0; i<n; i++)
+    {
+        chdata[i] = data[i*nchans+j];
+        constant = constant and chdata[i] == chdata[0];
+    }
+    if (constant)
+    {
+        median = chdata[0];
+        mad = 0.;
+        return;
+    }
+
+    std::nth_element(chdata, chdata+n/2, chdata+n);
+    median = chdata[n/2];
+
+    for (long int i=0; i<n; i++)
+    {
+        chdata[i] = abs(chdata[i]-median);
+    }
+    std::nth_element(chdata, chdata+n/2, chdata+n);
+    mad = chdata[n/2];
+}
+
+/**
+ * @brief Update the streaming median and MAD with n time-major samples (ROBUST).
+ *        The first chunk is measured exactly, later samples move the median and MAD by
+ *        a step of tsamp/timescale of the current std towards each sample (frugal sign update).
+ *        A channel whose MAD is still 0 (zero or quantized so far) can not move
+ *        and is measured exactly again, channels masked by mask (0) are not measured
+ */
+void ChannelStatistics::update_robust(const float *data, long int n, const int *mask)
+{
+#ifdef _OPENMP
+    long int nthread = num_threads;
+#else
+    long int nthread = 1;
+#endif
+    if ((long int)chdata.size() < nthread*n) chdata.resize(nthread*n);
+
+    vector<float> step(nchans, 0.);
+    if (nupdate > 0)
+    {
+        float eta = tsamp/timescale;
+        for (long int j=0; j<nchans; j++)
+        {
+            step[j] = eta*1.4826*mad[j];
+        }
+
+        long int nblock = 64;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+        for (long int jb=0; jb<nchans; jb+=nblock)
+        {
+            long int je = min(jb+nblock, nchans);
+            for (long int i=0; i<n; i++)
+            {
+                for (long int j=jb; j<je; j++)
+                {
+                    float d = data[i*nchans+j]-median[j];
+                    median[j] += step[j]*((d>0)-(d<0));
+                    float e = abs(d)-mad[j];
+                    mad[j] += step[j]*((e>0)-(e<0));
+                }
+            }
+        }
+    }
+
+    /** every channel on the first chunk, then the channels that did not move */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int j=0; j<nchans; j++)
+    {
+        if (step[j] != 0 or (mask != NULL and !mask[j])) continue;
+#ifdef _OPENMP
+        float *buf = &chdata[0]+omp_get_thread_num()*n;
+#else
+        float *buf = &chdata[0];
+#endif
+        measure_robust(data, n, nchans, j, buf, median[j], mad[j]);
+    }
+
+    for (long int j=0; j<nchans; j++)
+    {
+        mean[j] = median[j];
+        power[j] = median[j]*median[j]+(1.4826*mad[j])*(1.4826*mad[j]);
+    }
+
+    nupdate++;
+}
+
+/**
+ * @brief Get the mean and std of every channel, std is 1 for constant channels
+ */
+void ChannelStatistics::get(vector<double> &chmean, vector<double> &chstd) const
+{
+    for (long int j=0; j<nchans; j++)
+    {
+        chmean[j] = mean[j];
+        chstd[j] = power[j];
+        chstd[j] -= chmean[j]*chmean[j];
+        chstd[j] = chstd[j]>0 ? sqrt(chstd[j]):0.;
+        if (chstd[j] == 0)
+        {
+            chstd[j] = 1;
+        }
+    }
+}
+
+bool ChannelStatistics::parse_mode(const string &s, enum Mode &m)
+{
+    if (s == "chunk") m = CHUNK;
+    else if (s == "ewma") m = EWMA;
+    else if (s == "window") m = WINDOW;
+    else if (s == "robust") m = ROBUST;
+    else return false;
+
+    return true;
+}
+
 Equalize::Equalize(){}
 
 Equalize::Equalize(const Equalize &equalize) : DataBuffer<float>(equalize)
-{}
+{
+    stats = equalize.stats;
+}
 
 Equalize & Equalize::operator=(const Equalize &equalize)
 {
     DataBuffer<float>::operator=(equalize);
+
+    stats = equalize.stats;
+
     return *this;
 }
 
@@ -38,33 +271,33 @@ void Equalize::prepare(DataBuffer<float> &databuffer)
 
     chmean.resize(nchans, 0.);
     chstd.resize(nchans, 0.);
+
+    stats.prepare(nchans, nsamples, tsamp);
 }
 
 void Equalize::run(DataBuffer<float> &databuffer)
 {
-    fill(chmean.begin(), chmean.end(), 0.);
-    fill(chstd.begin(), chstd.end(), 0.);
-
-    for (long int i=0; i<nsamples; i++)
+    if (stats.mode == ChannelStatistics::ROBUST)
     {
-        for (long int j=0; j<nchans; j++)
-        {
-            chmean[j] += databuffer.buffer[i*nchans+j];
-            chstd[j] += databuffer.buffer[i*nchans+j]*databuffer.buffer[i*nchans+j];
-        }
+        stats.update_robust(&databuffer.buffer[0], nsamples, databuffer.chmask.empty() ? NULL : &databuffer.chmask[0]);
     }
-
-    for (long int j=0; j<nchans; j++)
+    else
     {
-        chmean[j] /= nsamples;
-        chstd[j] /= nsamples;
-        chstd[j] -= chmean[j]*chmean[j];
-        chstd[j] = sqrt(chstd[j]);
-        if (chstd[j] == 0)
+        fill(chmean.begin(), chmean.end(), 0.);
+        fill(chstd.begin(), chstd.end(), 0.);
+
+        for (long int i=0; i<nsamples; i++)
         {
-            chstd[j] = 1;
+            for (long int j=0; j<nchans; j++)
+            {
+                chmean[j] += databuffer.buffer[i*nchans+j];
+                chstd[j] += databuffer.buffer[i*nchans+j]*databuffer.buffer[i*nchans+j];
+            }
         }
+
+        stats.update(&chmean[0], &chstd[0], nsamples);
     }
+    stats.get(chmean, chstd);
 
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads)
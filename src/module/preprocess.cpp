@@ -0,0 +1,195 @@
+/*
+ * preprocess.cpp
+ *
+ *  Created on: Nov 5, 2020
+ *      Author: ypmen
+ */
+
+#include <string.h>
+
+#include "dedisperse.h"
+#include "downsample.h"
+#include "preprocess.h"
+
+using namespace std;
+
+/** input bytes per tile of pass 1 */
+#define PREPROCESS_TILE (256*1024)
+
+Preprocess::Preprocess()
+{
+    td = 1;
+    fd = 1;
+}
+
+Preprocess::Preprocess(const Preprocess &preprocess) : DataBuffer<float>(preprocess)
+{
+    td = preprocess.td;
+    fd = preprocess.fd;
+    weights = preprocess.weights;
+    chmean = preprocess.chmean;
+    chstd = preprocess.chstd;
+    stats = preprocess.stats;
+}
+
+Preprocess & Preprocess::operator=(const Preprocess &preprocess)
+{
+    DataBuffer<float>::operator=(preprocess);
+
+    td = preprocess.td;
+    fd = preprocess.fd;
+    weights = preprocess.weights;
+    chmean = preprocess.chmean;
+    chstd = preprocess.chstd;
+    stats = preprocess.stats;
+
+    return *this;
+}
+
+Preprocess::Preprocess(int tds, int fds)
+{
+    td = tds;
+    fd = fds;
+}
+
+Preprocess::~Preprocess(){}
+
+void Preprocess::prepare(DataBuffer<float> &databuffer)
+{
+    assert(databuffer.nsamples%td == 0);
+
+    nsamples = databuffer.nsamples/td;
+    nchans = databuffer.nchans/fd;
+    resize(nsamples, nchans);
+
+    tsamp = databuffer.tsamp*td;
+
+    fill(frequencies.begin(), frequencies.end(), 0.);
+    for (long int j=0; j<nchans; j++)
+    {
+        for (long int k=0; k<fd; k++)
+        {
+            frequencies[j] += databuffer.frequencies[j*fd+k];
+        }
+        frequencies[j] /= fd;
+    }
+
+    weights.resize(nchans, 1);
+    chmean.resize(nchans, 0.);
+    chstd.resize(nchans, 0.);
+
+    stats.prepare(nchans, nsamples, tsamp);
+}
+
+/**
+ * @brief Mask the channels in zaplist, the mask is applied in every run
+ */
+void Preprocess::zap(const vector<pair<double, double>> &zaplist)
+{
+    for (long int j=0; j<nchans; j++)
+    {
+        for (auto k=zaplist.begin(); k!=zaplist.end(); ++k)
+        {
+            if (frequencies[j]>=(*k).first and frequencies[j]<=(*k).second)
+            {
+                weights[j] = 0;
+            }
+        }
+    }
+}
+
+void Preprocess::run(DataBuffer<float> &databuffer)
+{
+    long int ntile = PREPROCESS_TILE/(sizeof(float)*td*databuffer.nchans);
+    ntile = ntile>0 ? ntile:1;
+    long int ntiles = (nsamples+ntile-1)/ntile;
+
+    arena.reset();
+
+#ifdef _OPENMP
+    long int nthread = num_threads;
+#else
+    long int nthread = 1;
+#endif
+    double *chsum_t = arena.alloc<double>(nthread*nchans, 0.);
+    double *chsum2_t = arena.alloc<double>(nthread*nchans, 0.);
+
+    /** pass 1: downsample and accumulate the statistics while the tile is in cache */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int t=0; t<ntiles; t++)
+    {
+#ifdef _OPENMP
+        double *chsum = chsum_t+omp_get_thread_num()*nchans;
+        double *chsum2 = chsum2_t+omp_get_thread_num()*nchans;
+#else
+        double *chsum = chsum_t;
+        double *chsum2 = chsum2_t;
+#endif
+
+        long int istart = t*ntile;
+        long int iend = min(istart+ntile, nsamples);
+
+        downsample_sum(&buffer[0]+istart*nchans, &databuffer.buffer[0]+istart*td*databuffer.nchans, (iend-istart)*td, databuffer.nchans, td, fd, false);
+
+        if (stats.mode == ChannelStatistics::ROBUST) continue;
+
+        for (long int i=istart; i<iend; i++)
+        {
+            for (long int j=0; j<nchans; j++)
+            {
+                double temp = buffer[i*nchans+j];
+                chsum[j] += temp;
+                chsum2[j] += temp*temp;
+            }
+        }
+    }
+
+    if (stats.mode == ChannelStatistics::ROBUST)
+    {
+        stats.update_robust(&buffer[0], nsamples, &weights[0]);
+    }
+    else
+    {
+        fill(chmean.begin(), chmean.end(), 0.);
+        fill(chstd.begin(), chstd.end(), 0.);
+        for (long int k=0; k<nthread; k++)
+        {
+            for (long int j=0; j<nchans; j++)
+            {
+                chmean[j] += chsum_t[k*nchans+j];
+                chstd[j] += chsum2_t[k*nchans+j];
+            }
+        }
+
+        stats.update(&chmean[0], &chstd[0], nsamples);
+    }
+    stats.get(chmean, chstd);
+
+    float *scale = arena.alloc<float>(nchans);
+    float *offset = arena.alloc<float>(nchans);
+    for (long int j=0; j<nchans; j++)
+    {
+        offset[j] = chmean[j];
+        /** zapped channels are exactly zero, also when their std is zero */
+        scale[j] = weights[j] ? 1./chstd[j] : 0.;
+    }
+
+    /** pass 2: normalize and apply the channel mask */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int i=0; i<nsamples; i++)
+    {
+        for (long int j=0; j<nchans; j++)
+        {
+            buffer[i*nchans+j] = (buffer[i*nchans+j]-offset[j])*scale[j];
+        }
+    }
+
+    chmask = weights;
+
+    equalized = true;
+    counter += nsamples;
+}
@@ -7,17 +7,381 @@
 
 #include "string.h"
 
+#include <limits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "rfi.h"
+#include "downsample.h"
 #include "kdtree.h"
 #include "dedisperse.h"
 
 using namespace std;
 
-RFI::RFI(){}
+/** input bytes per tile of the shared downsample */
+#define RFI_TILE (256*1024)
+
+/**
+ * @brief Exact order statistics by histogram: the values are counted into bins between vmin and vmax in parallel,
+ *        the bins holding the ranks are counted again into sub-bins between the extremes of their values, then
+ *        nth_element only runs on the values of the sub-bins holding the ranks. Ranks in the same bin or sub-bin
+ *        share its counts and its values, so an outlier that squeezes all the ranks into one bin does not select
+ *        most of the data
+ *
+ * @param data: n values within [vmin, vmax]
+ * @param ranks: nq ranks in ascending order, 0 is the smallest
+ * @param q: q[k] is the value of rank ranks[k]
+ * @param arena: scratch for the histograms and the selected values
+ */
+static void histogram_select(const float *data, long int n, float vmin, float vmax, const long int *ranks, long int nq, float *q, Arena &arena)
+{
+    fill(q, q+nq, vmin);
+    if (!(vmax > vmin)) return;
+
+    const long int nbins = 4096;
+    float scale = nbins/(vmax-vmin);
+    auto getbin = [vmin, scale, nbins](float x) -> long int
+    {
+        long int b = (x-vmin)*scale;
+        return b<0 ? 0:(b<nbins ? b:nbins-1);
+    };
+
+#ifdef _OPENMP
+    long int nthread = num_threads;
+#else
+    long int nthread = 1;
+#endif
+
+    long int *hist_t = arena.alloc<long int>(nthread*nbins, 0);
+    float *binmin_t = arena.alloc<float>(nthread*nbins, numeric_limits<float>::max());
+    float *binmax_t = arena.alloc<float>(nthread*nbins, -numeric_limits<float>::max());
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+    for (long int i=0; i<n; i++)
+    {
+#ifdef _OPENMP
+        long int idx = omp_get_thread_num()*nbins+getbin(data[i]);
+#else
+        long int idx = getbin(data[i]);
+#endif
+        hist_t[idx]++;
+        binmin_t[idx] = min(binmin_t[idx], data[i]);
+        binmax_t[idx] = max(binmax_t[idx], data[i]);
+    }
+    long int *hist = arena.alloc<long int>(nbins, 0);
+    float *binmin = arena.alloc<float>(nbins, numeric_limits<float>::max());
+    float *binmax = arena.alloc<float>(nbins, -numeric_limits<float>::max());
+    for (long int k=0; k<nthread; k++)
+    {
+        for (long int b=0; b<nbins; b++)
+        {
+            hist[b] += hist_t[k*nbins+b];
+            binmin[b] = min(binmin[b], binmin_t[k*nbins+b]);
+            binmax[b] = max(binmax[b], binmax_t[k*nbins+b]);
+        }
+    }
+
+    /** bin and rank within the bin of each quantile, the ranks are ascending so equal bins are adjacent */
+    long int *qbin = arena.alloc<long int>(nq);
+    long int *qrank = arena.alloc<long int>(nq);
+    long int *dbin = arena.alloc<long int>(nq);
+    long int *qd = arena.alloc<long int>(nq);
+    long int nd = 0;
+    for (long int k=0; k<nq; k++)
+    {
+        long int cum = 0;
+        long int b = 0;
+        while (cum+hist[b] <= ranks[k])
+        {
+            cum += hist[b++];
+        }
+        qbin[k] = b;
+        qrank[k] = ranks[k]-cum;
+
+        if (nd == 0 or dbin[nd-1] != b)
+            dbin[nd++] = b;
+        qd[k] = nd-1;
+    }
+
+    /** the sub-bins of distinct bin d span the values in it, a bin of equal values gets a single sub-bin */
+    float *sublo = arena.alloc<float>(nd);
+    float *subscale = arena.alloc<float>(nd);
+    for (long int d=0; d<nd; d++)
+    {
+        sublo[d] = binmin[dbin[d]];
+        float w = binmax[dbin[d]]-binmin[dbin[d]];
+        subscale[d] = w>0 ? nbins/w:0.f;
+    }
+    auto getsub = [sublo, subscale, nbins](float x, long int d) -> long int
+    {
+        long int s = (x-sublo[d])*subscale[d];
+        return s<0 ? 0:(s<nbins ? s:nbins-1);
+    };
+
+    /** sub-bins of each distinct bin with their extremes, a sub-bin of equal values needs no selection */
+    long int *subhist_t = arena.alloc<long int>(nthread*nd*nbins, 0);
+    float *submin_t = arena.alloc<float>(nthread*nd*nbins, numeric_limits<float>::max());
+    float *submax_t = arena.alloc<float>(nthread*nd*nbins, -numeric_limits<float>::max());
+    long int *subhist = arena.alloc<long int>(nd*nbins, 0);
+    float *submin = arena.alloc<float>(nd*nbins, numeric_limits<float>::max());
+    float *submax = arena.alloc<float>(nd*nbins, -numeric_limits<float>::max());
+
+    /** sub-bin and rank within it of each quantile, the distinct sub-bins whose values have to be selected */
+    long int *qcell = arena.alloc<long int>(nq);
+    long int *qc = arena.alloc<long int>(nq);
+    long int *cell = arena.alloc<long int>(nq);
+    long int nc = 0;
+
+    /** the values in each cell, thread t writes from the count of the threads before it */
+    float **selected = arena.alloc<float *>(nq);
+    long int *pos_t = arena.alloc<long int>(nthread*nq);
+
+    /** the counts and the scatter share one team and one static schedule, so each thread scatters the values it counted */
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+    {
+#ifdef _OPENMP
+        long int t = omp_get_thread_num();
+#else
+        long int t = 0;
+#endif
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (long int i=0; i<n; i++)
+        {
+            long int b = getbin(data[i]);
+            for (long int d=0; d<nd; d++)
+            {
+                if (b != dbin[d]) continue;
+                long int idx = (t*nd+d)*nbins+getsub(data[i], d);
+                subhist_t[idx]++;
+                submin_t[idx] = min(submin_t[idx], data[i]);
+                submax_t[idx] = max(submax_t[idx], data[i]);
+            }
+        }
+
+#ifdef _OPENMP
+#pragma omp single
+#endif
+        {
+            for (long int l=0; l<nthread; l++)
+            {
+                for (long int m=0; m<nd*nbins; m++)
+                {
+                    subhist[m] += subhist_t[l*nd*nbins+m];
+                    submin[m] = min(submin[m], submin_t[l*nd*nbins+m]);
+                    submax[m] = max(submax[m], submax_t[l*nd*nbins+m]);
+                }
+            }
+
+            for (long int k=0; k<nq; k++)
+            {
+                const long int *h = subhist+qd[k]*nbins;
+                long int cum = 0;
+                long int s = 0;
+                while (cum+h[s] <= qrank[k])
+                {
+                    cum += h[s++];
+                }
+                qcell[k] = qd[k]*nbins+s;
+                qrank[k] -= cum;
+
+                qc[k] = -1;
+                if (submin[qcell[k]] == submax[qcell[k]])
+                {
+                    q[k] = submin[qcell[k]];
+                    continue;
+                }
+
+                if (nc == 0 or cell[nc-1] != qcell[k])
+                    cell[nc++] = qcell[k];
+                qc[k] = nc-1;
+            }
+
+            for (long int c=0; c<nc; c++)
+            {
+                selected[c] = arena.alloc<float>(subhist[cell[c]]);
+                long int cum = 0;
+                for (long int l=0; l<nthread; l++)
+                {
+                    pos_t[l*nc+c] = cum;
+                    cum += subhist_t[l*nd*nbins+cell[c]];
+                }
+            }
+        }
+
+        if (nc > 0)
+        {
+            long int *pos = pos_t+t*nc;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+            for (long int i=0; i<n; i++)
+            {
+                long int b = getbin(data[i]);
+                for (long int c=0; c<nc; c++)
+                {
+                    long int d = cell[c]/nbins;
+                    if (b == dbin[d] and getsub(data[i], d) == cell[c]%nbins)
+                        selected[c][pos[c]++] = data[i];
+                }
+            }
+        }
+    }
+
+    /** nth_element only permutes, so ranks sharing a cell are selected one after another */
+    for (long int k=0; k<nq; k++)
+    {
+        if (qc[k] < 0) continue;
+        long int c = qc[k];
+        std::nth_element(selected[c], selected[c]+qrank[k], selected[c]+subhist[cell[c]]);
+        q[k] = selected[c][qrank[k]];
+    }
+}
+
+/**
+ * @brief Kadane of nlane series and of their negatives in one sweep, series l is x[l*lstride+i*istride], i<n.
+ *        Each result matches kadane<float> on the series (maxsum, start, end) and on its negative (maxsumN, startN, endN)
+ */
+static void kadane_batch(const float *x, long int n, long int istride, long int lstride, int nlane,
+                         float *maxsum, long int *start, long int *end, float *maxsumN, long int *startN, long int *endN)
+{
+#ifdef __AVX2__
+    if (nlane == 8)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 signmask = _mm256_set1_ps(-0.f);
+        const __m256i lidx = _mm256_setr_epi32(0, lstride, 2*lstride, 3*lstride, 4*lstride, 5*lstride, 6*lstride, 7*lstride);
+
+        __m256 sum[2] = {zero, zero};
+        __m256 mxs[2] = {_mm256_set1_ps(-numeric_limits<float>::infinity()), _mm256_set1_ps(-numeric_limits<float>::infinity())};
+        __m256i st[2] = {_mm256_setzero_si256(), _mm256_setzero_si256()};
+        __m256i en[2] = {_mm256_set1_epi32(-1), _mm256_set1_epi32(-1)};
+        __m256i ls[2] = {_mm256_setzero_si256(), _mm256_setzero_si256()};
+
+        for (long int i=0; i<n; i++)
+        {
+            __m256 v = lstride == 1 ? _mm256_loadu_ps(x+i*istride) : _mm256_i32gather_ps(x+i*istride, lidx, 4);
+            __m256 vs[2] = {v, _mm256_xor_ps(v, signmask)};
+            __m256i vi = _mm256_set1_epi32(i);
+            __m256i vi1 = _mm256_set1_epi32(i+1);
+
+            for (int p=0; p<2; p++)
+            {
+                __m256 s = _mm256_add_ps(sum[p], vs[p]);
+                __m256 neg = _mm256_cmp_ps(s, zero, _CMP_LT_OQ);
+                __m256 gt = _mm256_andnot_ps(neg, _mm256_cmp_ps(s, mxs[p], _CMP_GT_OQ));
+                __m256i gti = _mm256_castps_si256(gt);
+
+                mxs[p] = _mm256_blendv_ps(mxs[p], s, gt);
+                st[p] = _mm256_blendv_epi8(st[p], ls[p], gti);
+                en[p] = _mm256_blendv_epi8(en[p], vi, gti);
+
+                sum[p] = _mm256_andnot_ps(neg, s);
+                ls[p] = _mm256_blendv_epi8(ls[p], vi1, _mm256_castps_si256(neg));
+            }
+        }
+
+        float mxs_t[2][8];
+        int st_t[2][8], en_t[2][8];
+        for (int p=0; p<2; p++)
+        {
+            _mm256_storeu_ps(mxs_t[p], mxs[p]);
+            _mm256_storeu_si256((__m256i *)st_t[p], st[p]);
+            _mm256_storeu_si256((__m256i *)en_t[p], en[p]);
+        }
+
+        for (int l=0; l<8; l++)
+        {
+            maxsum[l] = mxs_t[0][l]; start[l] = st_t[0][l]; end[l] = en_t[0][l];
+            maxsumN[l] = mxs_t[1][l]; startN[l] = st_t[1][l]; endN[l] = en_t[1][l];
+        }
+    }
+    else
+#endif
+    {
+        float sum[2][8];
+        long int ls[2][8];
+        for (int l=0; l<nlane; l++)
+        {
+            sum[0][l] = sum[1][l] = 0.;
+            ls[0][l] = ls[1][l] = 0;
+            maxsum[l] = maxsumN[l] = -numeric_limits<float>::infinity();
+            start[l] = startN[l] = 0;
+            end[l] = endN[l] = -1;
+        }
+
+        for (long int i=0; i<n; i++)
+        {
+            for (int l=0; l<nlane; l++)
+            {
+                float v = x[l*lstride+i*istride];
+
+                sum[0][l] += v;
+                if (sum[0][l] < 0)
+                {
+                    sum[0][l] = 0;
+                    ls[0][l] = i+1;
+                }
+                else if (sum[0][l] > maxsum[l])
+                {
+                    maxsum[l] = sum[0][l];
+                    start[l] = ls[0][l];
+                    end[l] = i;
+                }
+
+                sum[1][l] += -v;
+                if (sum[1][l] < 0)
+                {
+                    sum[1][l] = 0;
+                    ls[1][l] = i+1;
+                }
+                else if (sum[1][l] > maxsumN[l])
+                {
+                    maxsumN[l] = sum[1][l];
+                    startN[l] = ls[1][l];
+                    endN[l] = i;
+                }
+            }
+        }
+    }
+
+    /** no non-negative prefix, same as kadane<float> */
+    for (int l=0; l<nlane; l++)
+    {
+        if (end[l] == -1)
+        {
+            maxsum[l] = x[l*lstride];
+            start[l] = end[l] = 0;
+        }
+        if (endN[l] == -1)
+        {
+            maxsumN[l] = -x[l*lstride];
+            startN[l] = endN[l] = 0;
+        }
+    }
+}
+
+RFI::RFI()
+{
+    ds_valid = false;
+    td_ds = 1;
+    fd_ds = 1;
+}
 
 RFI::RFI(const RFI &rfi) : DataBuffer<float>(rfi)
 {
     weights = rfi.weights;
+    ds_valid = rfi.ds_valid;
+    td_ds = rfi.td_ds;
+    fd_ds = rfi.fd_ds;
+    buffer_ds = rfi.buffer_ds;
 }
 
 RFI & RFI::operator=(const RFI &rfi)
@@ -25,6 +389,10 @@ RFI & RFI::operator=(const RFI &rfi)
     DataBuffer<float>::operator=(rfi);
 
     weights = rfi.weights;
+    ds_valid = rfi.ds_valid;
+    td_ds = rfi.td_ds;
+    fd_ds = rfi.fd_ds;
+    buffer_ds = rfi.buffer_ds;
 
     return *this;  
 }
@@ -42,10 +410,14 @@ void RFI::prepare(const DataBuffer<float> &databuffer)
     frequencies = databuffer.frequencies;
 
     weights.resize(nchans, 1);
+
+    ds_valid = false;
 }
 
 void RFI::zap(DataBuffer<float> &databuffer, const vector<pair<double, double>> &zaplist)
 {
+    ds_valid = false;
+
     for (long int j=0; j<nchans; j++)
     {
         for (auto k=zaplist.begin(); k!=zaplist.end(); ++k)
@@ -57,6 +429,13 @@ void RFI::zap(DataBuffer<float> &databuffer, const vector<pair<double, double>>
         }
     }
 
+    chmask = databuffer.chmask;
+    chmask.resize(nchans, 1);
+    for (long int j=0; j<nchans; j++)
+    {
+        if (!weights[j]) chmask[j] = 0;
+    }
+
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads)
 #endif
@@ -74,40 +453,72 @@ void RFI::zap(DataBuffer<float> &databuffer, const vector<pair<double, double>>
 
 void RFI::zdot(DataBuffer<float> &databuffer)
 {
-    vector<float> xe(nchans, 0.);
-    vector<float> xs(nchans, 0.);
-    vector<float> alpha(nchans, 0.);
-    vector<float> beta(nchans, 0.);
-    vector<float> s(nsamples, 0.);
-    float se = 0.;
-    float ss = 0.;
+    ds_valid = false;
+    arena.reset();
+
+    float *s = arena.alloc<float>(nsamples, 0.f);
+    double se = 0.;
+    double ss = 0.;
+
+#ifdef _OPENMP
+    long int nthread = num_threads;
+#else
+    long int nthread = 1;
+#endif
+    float *xe_t = arena.alloc<float>(nthread*nchans, 0.f);
+    float *xs_t = arena.alloc<float>(nthread*nchans, 0.f);
 
+    /** zero-DM series and its correlation with every channel, thread-local partial sums */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) reduction(+:se,ss)
+#endif
     for (long int i=0; i<nsamples; i++)
     {
-        float temp = 0.;
-        for (long int j=0; j<nchans; j++)
-        {
-            temp += databuffer.buffer[i*nchans+j];
-        }
+#ifdef _OPENMP
+        float *xe = xe_t+omp_get_thread_num()*nchans;
+        float *xs = xs_t+omp_get_thread_num()*nchans;
+#else
+        float *xe = xe_t;
+        float *xs = xs_t;
+#endif
+        const float *row = &databuffer.buffer[0]+i*nchans;
 
+        float temp = 0.;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:temp)
+#endif
         for (long int j=0; j<nchans; j++)
         {
-            xe[j] += databuffer.buffer[i*nchans+j];
+            temp += row[j];
         }
-
         temp /= nchans;
+
         se += temp;
         ss += temp*temp;
-        
+
         for (long int j=0; j<nchans; j++)
         {
-            xs[j] += databuffer.buffer[i*nchans+j]*temp;
+            xe[j] += row[j];
+            xs[j] += row[j]*temp;
         }
 
         s[i] = temp;
     }
 
-    float tmp = se*se-ss*nsamples;
+    double *xe = arena.alloc<double>(nchans, 0.);
+    double *xs = arena.alloc<double>(nchans, 0.);
+    for (long int k=0; k<nthread; k++)
+    {
+        for (long int j=0; j<nchans; j++)
+        {
+            xe[j] += xe_t[k*nchans+j];
+            xs[j] += xs_t[k*nchans+j];
+        }
+    }
+
+    float *alpha = arena.alloc<float>(nchans);
+    float *beta = arena.alloc<float>(nchans);
+    double tmp = se*se-ss*nsamples;
     for (long int j=0; j<nchans; j++)
     {
         alpha[j] = (xe[j]*se-xs[j]*nsamples)/tmp;
@@ -125,84 +536,181 @@ void RFI::zdot(DataBuffer<float> &databuffer)
         }
     }
 
+    /** zero channels have zero alpha and beta and stay zero */
+    chmask = databuffer.chmask;
+    chmask.resize(nchans, 1);
+
     equalized = false;
 }
 
 void RFI::zero(DataBuffer<float> &databuffer)
 {
+    ds_valid = false;
+
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads)
 #endif
     for (long int i=0; i<nsamples; i++)
     {
+        const float *in = &databuffer.buffer[0]+i*nchans;
+        float *out = &buffer[0]+i*nchans;
+
         float s = 0;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:s)
+#endif
         for (long int j=0; j<nchans; j++)
         {
-            s += databuffer.buffer[i*nchans+j];
+            s += in[j];
         }
         s /= nchans;
 
         for (long int j=0; j<nchans; j++)
         {
-            buffer[i*nchans+j] = databuffer.buffer[i*nchans+j]-s;
+            out[j] = in[j]-s;
         }
     }
 
+    /** the zero-DM series is subtracted from the masked channels as well */
+    chmask.assign(nchans, 1);
+
     equalized = false;
 }
 
-bool RFI::mask(DataBuffer<float> &databuffer, float threRFI2, int td, int fd)
+/**
+ * @brief Downsample databuffer into buffer_ds by td and fd, reuse buffer_ds if it already holds
+ *        this downsample of buffer, and get the range of buffer_ds if vmin and vmax are given
+ */
+void RFI::downsample(DataBuffer<float> &databuffer, int td, int fd, float *vmin, float *vmax)
 {
     long int nsamples_ds = nsamples/td;
     long int nchans_ds = nchans/fd;
 
-    vector<float> buffer_ds(nsamples_ds*nchans_ds, 0.);
+    float mn = numeric_limits<float>::max();
+    float mx = -numeric_limits<float>::max();
+
+    if (&databuffer == this and ds_valid and td == td_ds and fd == fd_ds)
+    {
+        if (vmin == NULL and vmax == NULL) return;
 
-    //downsample
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads)
+#pragma omp parallel for num_threads(num_threads) reduction(min:mn) reduction(max:mx)
 #endif
-    for (long int i=0; i<nsamples_ds; i++)
+        for (long int i=0; i<nsamples_ds*nchans_ds; i++)
+        {
+            mn = min(mn, buffer_ds[i]);
+            mx = max(mx, buffer_ds[i]);
+        }
+    }
+    else
     {
-        for (long int n=0; n<td; n++)
+        buffer_ds.resize(nsamples_ds*nchans_ds);
+
+        long int ntile = RFI_TILE/(sizeof(float)*td*nchans);
+        ntile = ntile>0 ? ntile:1;
+        long int ntiles = (nsamples_ds+ntile-1)/ntile;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) reduction(min:mn) reduction(max:mx)
+#endif
+        for (long int t=0; t<ntiles; t++)
         {
-            for (long int k=0; k<fd; k++)
+            long int istart = t*ntile;
+            long int iend = min(istart+ntile, nsamples_ds);
+
+            downsample_sum(&buffer_ds[0]+istart*nchans_ds, &databuffer.buffer[0]+istart*td*nchans, (iend-istart)*td, nchans, td, fd, false);
+
+            if (vmin == NULL and vmax == NULL) continue;
+
+            for (long int i=istart*nchans_ds; i<iend*nchans_ds; i++)
             {
-                for (long int j=0; j<nchans_ds; j++)
-                {
-                    buffer_ds[i*nchans_ds+j] += databuffer.buffer[(i*td+n)*nchans+j*fd+k];
-                }
+                mn = min(mn, buffer_ds[i]);
+                mx = max(mx, buffer_ds[i]);
             }
         }
+
+        /** buffer is a copy of databuffer from here on */
+        ds_valid = true;
+        td_ds = td;
+        fd_ds = fd;
     }
 
-    buffer = databuffer.buffer;
+    if (vmin != NULL) *vmin = mn;
+    if (vmax != NULL) *vmax = mx;
+}
+
+bool RFI::mask(DataBuffer<float> &databuffer, float threRFI2, int td, int fd)
+{
+    long int nsamples_ds = nsamples/td;
+    long int nchans_ds = nchans/fd;
+
+    float vmin, vmax;
+    downsample(databuffer, td, fd, &vmin, &vmax);
 
-    vector<float> buffer_dscopy = buffer_ds;
-	std::nth_element(buffer_dscopy.begin(), buffer_dscopy.begin()+nsamples_ds*nchans_ds/4, buffer_dscopy.end(), std::less<float>());
-    float Q1 = buffer_dscopy[nsamples_ds*nchans_ds/4];
-	std::nth_element(buffer_dscopy.begin(), buffer_dscopy.begin()+nsamples_ds*nchans_ds/2, buffer_dscopy.end(), std::less<float>());
-    float Q2 = buffer_dscopy[nsamples_ds*nchans_ds/2];
-    std::nth_element(buffer_dscopy.begin(), buffer_dscopy.begin()+nsamples_ds*nchans_ds/4, buffer_dscopy.end(), std::greater<float>());
-    float Q3 = buffer_dscopy[nsamples_ds*nchans_ds/4];
+    if (&databuffer != this)
+        buffer = databuffer.buffer;
+
+    arena.reset();
+
+    long int n = nsamples_ds*nchans_ds;
+    long int ranks[3] = {n/4, n/2, n-1-n/4};
+    float q[3];
+    histogram_select(&buffer_ds[0], n, vmin, vmax, ranks, 3, q, arena);
+    float Q1 = q[0];
+    float Q2 = q[1];
+    float Q3 = q[2];
 
 	float mean = Q2;
 	float var = ((Q3-Q1)/1.349)*((Q3-Q1)/1.349);
     float thre = threRFI2*var;
 
+#ifdef _OPENMP
+    long int nthread = num_threads;
+#else
+    long int nthread = 1;
+#endif
+    int *hit_t = arena.alloc<int>(nthread*nchans_ds, 0);
+
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads)
 #endif
     for (long int i=0; i<nsamples_ds; i++)
     {
-        for (long int n=0; n<td; n++)
+#ifdef _OPENMP
+        int *hit = hit_t+omp_get_thread_num()*nchans_ds;
+#else
+        int *hit = hit_t;
+#endif
+        for (long int j=0; j<nchans_ds; j++)
+        {
+            if ((buffer_ds[i*nchans_ds+j]-mean)*(buffer_ds[i*nchans_ds+j]-mean)>thre)
+            {
+                for (long int n=0; n<td; n++)
+                {
+                    for (long int k=0; k<fd; k++)
+                    {
+                        buffer[(i*td+n)*nchans+j*fd+k] = mean;
+                    }
+                }
+                buffer_ds[i*nchans_ds+j] = mean*(td*fd);
+                hit[j] = 1;
+            }
+        }
+    }
+
+    /** the flagged cells are filled with the mean, so masked channels under a flag are no longer zero */
+    chmask = databuffer.chmask;
+    chmask.resize(nchans, 1);
+    if (mean != 0.)
+    {
+        for (long int l=0; l<nthread; l++)
         {
             for (long int j=0; j<nchans_ds; j++)
             {
+                if (!hit_t[l*nchans_ds+j]) continue;
                 for (long int k=0; k<fd; k++)
                 {
-                    if ((buffer_ds[i*nchans_ds+j]-mean)*(buffer_ds[i*nchans_ds+j]-mean)>thre)
-                        buffer[(i*td+n)*nchans+j*fd+k] = mean;
+                    chmask[j*fd+k] = 1;
                 }
             }
         }
@@ -221,134 +729,182 @@ bool RFI::kadaneF(DataBuffer<float> &databuffer, float threRFI2, double widthlim
         return false;
     }
 
-    vector<float> bufferT(nchans*nsamples, 0.);
-
-    transpose_pad<float>(&bufferT[0], &databuffer.buffer[0], nsamples, nchans);
-
     long int nsamples_ds = nsamples/td;
     long int nchans_ds = nchans/fd;
 
-    vector<float> bufferT_ds(nchans_ds*nsamples_ds, 0.);
+    downsample(databuffer, td, fd);
+
+    if (&databuffer != this)
+        buffer = databuffer.buffer;
+
+    int wnlimit = widthlimit/tsamp/td;
+    float var = td*fd;
+
+    chmask = databuffer.chmask;
+    chmask.resize(nchans, 1);
 
-    //downsample
+    /** 8 channels per batch, both signs in one sweep over the time-major downsampled data */
+    long int nbatch = (nchans_ds+7)/8;
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads)
 #endif
-    for (long int j=0; j<nchans_ds; j++)
+    for (long int b=0; b<nbatch; b++)
     {
-        for (long int k=0; k<fd; k++)
+        long int j0 = b*8;
+        int nlane = min(8L, nchans_ds-j0);
+
+        float boxsum[2][8];
+        long int start[2][8], end[2][8];
+        kadane_batch(&buffer_ds[j0], nsamples_ds, nchans_ds, 1, nlane, boxsum[0], start[0], end[0], boxsum[1], start[1], end[1]);
+
+        for (int l=0; l<nlane; l++)
         {
-            for (long int n=0; n<td; n++)
+            long int j = j0+l;
+            for (int p=0; p<2; p++)
             {
-                for (long int i=0; i<nsamples_ds; i++)       
+                long int wn = end[p][l]-start[p][l]+1;
+                float snr2 = 0.;
+                if (wn > wnlimit)
+                {
+                    snr2 = boxsum[p][l]*boxsum[p][l]/(wn*var);
+                }
+
+                if (snr2 > threRFI2)
                 {
-                    bufferT_ds[j*nsamples_ds+i] += bufferT[(j*fd+k)*nsamples+(i*td+n)];
+                    for (long int i=start[p][l]*td; i<(end[p][l]+1)*td; i++)
+                    {
+                        for (long int k=0; k<fd; k++)
+                        {
+                            buffer[i*nchans+j*fd+k] = 0.;
+                        }
+                    }
+                    for (long int i=start[p][l]; i<=end[p][l]; i++)
+                    {
+                        buffer_ds[i*nchans_ds+j] = 0.;
+                    }
+
+                    if (start[p][l] == 0 and end[p][l] == nsamples_ds-1 and nsamples_ds*td == nsamples)
+                    {
+                        for (long int k=0; k<fd; k++)
+                        {
+                            chmask[j*fd+k] = 0;
+                        }
+                    }
                 }
             }
         }
     }
 
-#ifdef _OPENMP
-    float *chdata_t = new float [num_threads*nsamples_ds];
-    memset(chdata_t, 0, sizeof(float)*num_threads*nsamples_ds);
-#else
-    float *chdata_t = new float [nsamples_ds];
-    memset(chdata_t, 0, sizeof(float)*nsamples_ds);
-#endif
+    equalized = databuffer.equalized;
 
-    int wnlimit = widthlimit/tsamp/td;
+    return true;
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads)
-#endif
-    for (long int j=0; j<nchans_ds; j++)
+bool RFI::kadaneT(DataBuffer<float> &databuffer, float threRFI2, double bandlimit, int td, int fd)
+{
+    if (!databuffer.equalized)
     {
-#ifdef _OPENMP
-        float *chdata = chdata_t+omp_get_thread_num()*nsamples_ds;
-#else
-        float *chdata = chdata_t;
-#endif
+        cerr<<"Error: data is not equalize"<<endl;
+        return false;
+    }
 
-        for (long int i=0; i<nsamples_ds; i++)
-        {
-            chdata[i] = bufferT_ds[j*nsamples_ds+i];
-        }
+    long int nsamples_ds = nsamples/td;
+    long int nchans_ds = nchans/fd;
 
-        long int start, end;
-        float snr2=0.;
-        float boxsum = kadane<float>(chdata, nsamples_ds, &start, &end);
-        long int wn = end-start+1;
+    downsample(databuffer, td, fd);
 
-        float mean = 0.;
-        float var = td*fd;    
-        if (wn > wnlimit)
-        {
-            snr2 = boxsum*boxsum/(wn*var);
-        }
-        else
-        {
-            snr2 = 0.;
-        }
+    if (&databuffer != this)
+        buffer = databuffer.buffer;
 
-        start *= td;
-        end += 1;
-        end *= td;
-        if (snr2 > threRFI2)
-        {
-            for (long int k=0; k<fd; k++)
-            {
-                for (long int i=start; i<end; i++)
-                {
-                    bufferT[(j*fd+k)*nsamples+i] = 0.;
-                }
-            }
-        }
+    int chnlimit = abs(bandlimit/(frequencies[1]-frequencies[0])/fd);
+    float var = td*fd;
 
-        //<0
-        for (long int i=0; i<nsamples_ds; i++)
-        {
-            chdata[i] = -chdata[i];
-        }
+    chmask = databuffer.chmask;
+    chmask.resize(nchans, 1);
 
-        snr2=0.;
-        boxsum = kadane<float>(chdata, nsamples_ds, &start, &end);
-        wn = end-start+1;
+    /** 8 samples per batch, both signs in one sweep along the channels */
+    bool stale = false;
+    long int nbatch = (nsamples_ds+7)/8;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) reduction(||:stale)
+#endif
+    for (long int b=0; b<nbatch; b++)
+    {
+        long int i0 = b*8;
+        int nlane = min(8L, nsamples_ds-i0);
 
-        if (wn > wnlimit)
-        {
-            snr2 = boxsum*boxsum/(wn*var);
-        }
-        else
-        {
-            snr2 = 0.;
-        }
+        float boxsum[2][8];
+        long int start[2][8], end[2][8];
+        kadane_batch(&buffer_ds[i0*nchans_ds], nchans_ds, 1, nchans_ds, nlane, boxsum[0], start[0], end[0], boxsum[1], start[1], end[1]);
 
-        start *= td;
-        end += 1;
-        end *= td;
-        if (snr2 > threRFI2)
+        for (int l=0; l<nlane; l++)
         {
-            for (long int k=0; k<fd; k++)
+            long int i = i0+l;
+            for (int p=0; p<2; p++)
             {
-                for (long int i=start; i<end; i++)
+                long int chn = end[p][l]-start[p][l]+1;
+                float snr2 = 0.;
+                if (chn > chnlimit)
+                {
+                    snr2 = boxsum[p][l]*boxsum[p][l]/(chn*var);
+                }
+
+                long int jstart = start[p][l]*fd;
+                long int jend = (end[p][l]+1)*fd;
+                bool fullband = chn > nchans_ds*0.8;
+                if (fullband)
                 {
-                    bufferT[(j*fd+k)*nsamples+i] = 0.;
+                    jstart = 0;
+                    jend = nchans-1;
+                }
+
+                if (snr2 > threRFI2)
+                {
+                    for (long int k=0; k<td; k++)
+                    {
+                        for (long int j=jstart; j<jend; j++)
+                        {
+                            buffer[(i*td+k)*nchans+j] = 0.;
+                        }
+                    }
+
+                    if (fullband)
+                    {
+                        stale = true;
+                    }
+                    else
+                    {
+                        for (long int j=start[p][l]; j<=end[p][l]; j++)
+                        {
+                            buffer_ds[i*nchans_ds+j] = 0.;
+                        }
+                    }
                 }
             }
         }
-        
     }
 
-    transpose_pad<float>(&buffer[0], &bufferT[0], nchans, nsamples);
+    /** the full band flag does not cover the last channel, so buffer_ds is not zero there */
+    if (stale) ds_valid = false;
 
     equalized = databuffer.equalized;
 
-    delete [] chdata_t;
-
     return true;
 }
 
-bool RFI::kadaneT(DataBuffer<float> &databuffer, float threRFI2, double bandlimit, int td, int fd)
+/**
+ * @brief Generalized spectral kurtosis on blocks of td samples x fd channels,
+ *        the power is recovered from the equalized data with the channel mean and std,
+ *        p = chmean*(1+x*chstd/chmean), and the shape d = (chmean/chstd)^2 is estimated per channel
+ * 
+ * @param databuffer equalized data
+ * @param chmean channel mean before equalization
+ * @param chstd channel std before equalization
+ * @param threSK threshold of |SK-1| in unit of the SK standard deviation
+ * @param td block length in samples
+ * @param fd block width in channels
+ */
+bool RFI::sk(DataBuffer<float> &databuffer, const vector<double> &chmean, const vector<double> &chstd, float threSK, int td, int fd)
 {
     if (!databuffer.equalized)
     {
@@ -356,130 +912,145 @@ bool RFI::kadaneT(DataBuffer<float> &databuffer, float threRFI2, double bandlimi
         return false;
     }
 
+    if (td*fd < 2)
+    {
+        cerr<<"Error: sk needs at least 2 samples per block"<<endl;
+        return false;
+    }
+
     long int nsamples_ds = nsamples/td;
     long int nchans_ds = nchans/fd;
 
-    vector<float> buffer_ds(nsamples_ds*nchans_ds, 0.);
+    /** buffer_ds is the downsample of the previous chunk then */
+    if (&databuffer != this)
+    {
+        buffer = databuffer.buffer;
+        ds_valid = false;
+    }
 
-    //downsample
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads)
-#endif
-    for (long int i=0; i<nsamples_ds; i++)
+    chmask = databuffer.chmask;
+    chmask.resize(nchans, 1);
+
+    /**
+     * r = std/mean of the power, channels with non-positive mean carry no power information and are skipped,
+     * so are the blocks whose channels are all masked
+     */
+    arena.reset();
+
+    float *r = arena.alloc<float>(nchans, 0.f);
+    int *valid = arena.alloc<int>(nchans_ds, 1);
+    int *nmasked = arena.alloc<int>(nchans_ds, 0);
+    for (long int j=0; j<nchans_ds*fd; j++)
     {
-        for (long int n=0; n<td; n++)
-        {
-            for (long int k=0; k<fd; k++)
-            {
-                for (long int j=0; j<nchans_ds; j++)
-                {
-                    buffer_ds[i*nchans_ds+j] += databuffer.buffer[(i*td+n)*nchans+j*fd+k];
-                }
-            }
-        }
+        if (chmean[j] > 0.)
+            r[j] = chstd[j]/chmean[j];
+        else
+            valid[j/fd] = 0;
+
+        if (!chmask[j]) nmasked[j/fd]++;
+    }
+    for (long int j=0; j<nchans_ds; j++)
+    {
+        if (nmasked[j] == fd) valid[j] = 0;
     }
 
-    buffer = databuffer.buffer;
+    long int M = td*fd;
+    bool update = ds_valid && td_ds == td && fd_ds == fd;
+    bool stale = false;
 
 #ifdef _OPENMP
-    float *tsdata_t = new float [num_threads*nchans_ds];
-    memset(tsdata_t, 0, sizeof(float)*num_threads*nchans_ds);
+    long int nthread = num_threads;
 #else
-    float *tsdata_t = new float [nchans_ds];
-    memset(tsdata_t, 0, sizeof(float)*nchans_ds);
+    long int nthread = 1;
 #endif
-
-    int chnlimit = abs(bandlimit/(frequencies[1]-frequencies[0])/fd);
+    float *sx_t = arena.alloc<float>(nthread*nchans, 0.f);
+    float *sxx_t = arena.alloc<float>(nthread*nchans, 0.f);
+    long int *nflag_t = arena.alloc<long int>(nthread*nchans_ds, 0);
 
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads)
+#pragma omp parallel for num_threads(num_threads) reduction(||:stale)
 #endif
     for (long int i=0; i<nsamples_ds; i++)
     {
 #ifdef _OPENMP
-        float *tsdata = tsdata_t+omp_get_thread_num()*nchans_ds;
+        float *sx = sx_t+omp_get_thread_num()*nchans;
+        float *sxx = sxx_t+omp_get_thread_num()*nchans;
+        long int *nflag = nflag_t+omp_get_thread_num()*nchans_ds;
 #else
-        float *tsdata = tsdata_t;
+        float *sx = sx_t;
+        float *sxx = sxx_t;
+        long int *nflag = nflag_t;
 #endif
+        fill(sx, sx+nchans, 0.);
+        fill(sxx, sxx+nchans, 0.);
 
-        for (long int j=0; j<nchans_ds; j++)
+        for (long int n=0; n<td; n++)
         {
-            tsdata[j] = buffer_ds[i*nchans_ds+j];
+            const float *row = &buffer[0]+(i*td+n)*nchans;
+            for (long int j=0; j<nchans; j++)
+            {
+                sx[j] += row[j];
+                sxx[j] += row[j]*row[j];
+            }
         }
 
-        long int start, end;
-        float snr2=0.;
-        float boxsum = kadane<float>(tsdata, nchans_ds, &start, &end);
-        long int chn = end-start+1;
-
-        float mean = 0.;
-        float var = td*fd;    
-
-        if (chn > chnlimit)
-        {
-            snr2 = boxsum*boxsum/(chn*var);
-        }
-        else
+        for (long int j=0; j<nchans_ds; j++)
         {
-            snr2 = 0.;
-        }
+            if (!valid[j]) continue;
 
-        start *= fd;
-        end += 1;
-        end *= fd;
-        if (chn > nchans_ds*0.8)
-        {
-            start = 0;
-            end = nchans-1;
-        }
+            /** with q = 1+x*r, M*sum(q^2)-sum(q)^2 = M*V-U^2, no cancellation from the channel offset */
+            double U = 0., V = 0., r2 = 0.;
+            for (long int k=j*fd; k<(j+1)*fd; k++)
+            {
+                U += r[k]*sx[k];
+                V += r[k]*r[k]*sxx[k];
+                r2 += r[k]*r[k];
+            }
+            if (r2 == 0.) continue;
 
-        if (snr2 > threRFI2)
-        {
-            for (long int k=0; k<td; k++)
+            double d = fd/r2;
+            double S1 = M+U;
+            double sk = (M*d+1.)/(M-1.)*(M*V-U*U)/(S1*S1);
+            double var = 2.*d*(d+1.)*M*M/((M-1.)*(M*d+2.)*(M*d+3.));
+
+            if ((sk-1.)*(sk-1.) > threSK*threSK*var)
             {
-                for (long int j=start; j<end; j++)
+                for (long int n=0; n<td; n++)
                 {
-                    buffer[(i*td+k)*nchans+j] = 0.;
+                    for (long int k=0; k<fd; k++)
+                    {
+                        buffer[(i*td+n)*nchans+j*fd+k] = 0.;
+                    }
                 }
-            }
-        }
 
-        //<0
-        for (long int j=0; j<nchans_ds; j++)
-        {
-            tsdata[j] = -tsdata[j];
-        }
+                if (update)
+                    buffer_ds[i*nchans_ds+j] = 0.;
+                else
+                    stale = true;
 
-        snr2=0.;
-        boxsum = kadane<float>(tsdata, nchans_ds, &start, &end);
-        chn = end-start+1;
-
-        if (chn > chnlimit)
-        {
-            snr2 = boxsum*boxsum/(chn*var);
-        }
-        else
-        {
-            snr2 = 0.;
+                nflag[j]++;
+            }
         }
+    }
 
-        start *= fd;
-        end += 1;
-        end *= fd;
-        
-        if (chn > nchans_ds*0.8)
-        {
-            start = 0;
-            end = nchans-1;
-        }
+    if (stale) ds_valid = false;
 
-        if (snr2 > threRFI2)
+    /** blocks flagged over the whole chunk */
+    if (nsamples_ds*td == nsamples)
+    {
+        for (long int j=0; j<nchans_ds; j++)
         {
-            for (long int k=0; k<td; k++)
+            long int cnt = 0;
+            for (long int l=0; l<nthread; l++)
             {
-                for (long int j=start; j<end; j++)
+                cnt += nflag_t[l*nchans_ds+j];
+            }
+
+            if (cnt == nsamples_ds)
+            {
+                for (long int k=0; k<fd; k++)
                 {
-                    buffer[(i*td+k)*nchans+j] = 0.;
+                    chmask[j*fd+k] = 0;
                 }
             }
         }
@@ -487,7 +1058,5 @@ bool RFI::kadaneT(DataBuffer<float> &databuffer, float threRFI2, double bandlimi
 
     equalized = databuffer.equalized;
 
-    delete [] tsdata_t;
-
     return true;
 }
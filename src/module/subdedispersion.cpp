@@ -10,14 +10,115 @@
 #include <algorithm>
 #include <assert.h>
 #include "subdedispersion.h"
+#include "utils.h"
 
 using namespace std;
 using namespace RealTime;
 
+/** channel-major circular history */
+template <typename T>
+static void ring_push(T *row, const float *in, long int nsamples, long int head, long int ns)
+{
+    long int n1 = min(ns, nsamples-head);
+    cvt_store(row+head, in, n1);
+    cvt_store(row, in+n1, ns-n1);
+}
+
+template <typename T>
+static void ring_add(float *out, const T *row, long int nsamples, long int head, long int t, long int ns)
+{
+    long int s0 = (head+t)%nsamples;
+    long int n1 = min(ns, nsamples-s0);
+    cvt_add(out, row+s0, n1);
+    cvt_add(out+n1, row, ns-n1);
+}
+
+template <typename T>
+static void ring_copy(float *out, const T *row, long int nsamples, long int head, long int t, long int ns)
+{
+    long int s0 = (head+t)%nsamples;
+    long int n1 = min(ns, nsamples-s0);
+    cvt_load(out, row+s0, n1);
+    cvt_load(out+n1, row, ns-n1);
+}
+
+History::History()
+{
+    precision = FP32;
+    nsamples = 0;
+    head = 0;
+}
+
+History::~History(){}
+
+void History::resize(long int nrows, long int ns)
+{
+    nsamples = ns;
+    head = 0;
+
+    buffer.clear();
+    buffer16.clear();
+    bufferbf16.clear();
+
+    float16_t zero16 = {0};
+    bfloat16_t zerobf16 = {0};
+    switch (precision)
+    {
+    case FP16: buffer16.resize(nrows*nsamples, zero16); break;
+    case BF16: bufferbf16.resize(nrows*nsamples, zerobf16); break;
+    default: buffer.resize(nrows*nsamples, 0.); break;
+    }
+}
+
+/**
+ * @brief Overwrite the oldest ns samples of row irow with in, call advance after all rows are pushed
+ */
+void History::push(long int irow, const float *in, long int ns)
+{
+    switch (precision)
+    {
+    case FP16: ring_push(&buffer16[0]+irow*nsamples, in, nsamples, head, ns); break;
+    case BF16: ring_push(&bufferbf16[0]+irow*nsamples, in, nsamples, head, ns); break;
+    default: ring_push(&buffer[0]+irow*nsamples, in, nsamples, head, ns); break;
+    }
+}
+
+void History::advance(long int ns)
+{
+    head = (head+ns)%nsamples;
+}
+
+/**
+ * @brief out += row irow from logical sample t (counted from the oldest sample), t+ns <= nsamples
+ */
+void History::add(float *out, long int irow, long int t, long int ns) const
+{
+    switch (precision)
+    {
+    case FP16: ring_add(out, &buffer16[0]+irow*nsamples, nsamples, head, t, ns); break;
+    case BF16: ring_add(out, &bufferbf16[0]+irow*nsamples, nsamples, head, t, ns); break;
+    default: ring_add(out, &buffer[0]+irow*nsamples, nsamples, head, t, ns); break;
+    }
+}
+
+/**
+ * @brief out = row irow from logical sample t (counted from the oldest sample), t+ns <= nsamples
+ */
+void History::copy(float *out, long int irow, long int t, long int ns) const
+{
+    switch (precision)
+    {
+    case FP16: ring_copy(out, &buffer16[0]+irow*nsamples, nsamples, head, t, ns); break;
+    case BF16: ring_copy(out, &bufferbf16[0]+irow*nsamples, nsamples, head, t, ns); break;
+    default: ring_copy(out, &buffer[0]+irow*nsamples, nsamples, head, t, ns); break;
+    }
+}
+
 Subband::Subband()
 {
     inplace = false;
 
+    precision = FP32;
     counter = 0;
     ndump = 0;
     nchans = 0;
@@ -46,55 +147,57 @@ void Subband::prepare()
         }
     }
 
-    buffer.resize(nsub*nsamples*nchans, 0.);
-    bufferT.resize(nsub*nchans*nsamples, 0.);
+    bufferT.precision = precision;
+    bufferT.resize(nsub*nchans, nsamples);
+    zerolen.assign(nsub*nchans, nsamples);
     buffertim.resize(nsub*ndm_per_sub*ndump, 0.);
 }
 
-void Subband::run(vector<float> &data)
+/**
+ * @brief Dedisperse the next chunk of (nchans, nsub, ndump) subband data
+ * 
+ * @param data channel-major, row k*nchans+j starts at data[(j*nsub+k)*ndump]
+ * @param mask 0 for rows k*nchans+j that are zero over the chunk, they are not pushed once
+ *             their history is zero, and not added where the delayed window is zero
+ */
+void Subband::run(vector<float> &data, const vector<int> &mask)
 {
-    long int nspace = nsamples-ndump;
-    for (long int k=0; k<nsub; k++)
+    /** the new chunk replaces the oldest ndump samples */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int irow=0; irow<nsub*nchans; irow++)
     {
-        for (long int i=0; i<ndump; i++)
+        long int k = irow/nchans;
+        long int j = irow%nchans;
+        if (mask[irow])
         {
-            for (long int j=0; j<nchans; j++)
-            {
-                buffer[k*nsamples*nchans+(i+nspace)*nchans+j] = data[k*ndump*nchans+i*nchans+j];
-            }
+            bufferT.push(irow, &data[0]+(j*nsub+k)*ndump, ndump);
+            zerolen[irow] = 0;
+        }
+        else
+        {
+            if (zerolen[irow] < nsamples)
+                bufferT.push(irow, &data[0]+(j*nsub+k)*ndump, ndump);
+            zerolen[irow] = min(zerolen[irow]+ndump, nsamples);
         }
     }
-
-    for (long int k=0; k<nsub; k++)
-    {
-        transpose_pad<float>(&bufferT[0]+k*nchans*nsamples, &buffer[0]+k*nsamples*nchans, nsamples, nchans);
-    }
+    bufferT.advance(ndump);
 
     fill(buffertim.begin(), buffertim.end(), 0.);
     for (long int k=0; k<nsub; k++)
     {
         for (long int j=0; j<nchans; j++)
         {
+            long int irow = k*nchans+j;
+            long int tzero = nsamples-zerolen[irow];
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads)
 #endif
             for (long int l=0; l<ndm_per_sub; l++)
             {
-                for (long int i=0; i<ndump; i++)
-                {
-                    buffertim[(k*ndm_per_sub+l)*ndump+i] += bufferT[(k*nchans+j)*nsamples+(i+mxdelayn[(k*nchans+j)*ndm_per_sub+l])];
-                }
-            }
-        }
-    }
-
-    for (long int k=0; k<nsub; k++)
-    {
-        for (long int i=0; i<nspace; i++)
-        {
-            for (long int j=0; j<nchans; j++)
-            {
-                buffer[k*nsamples*nchans+i*nchans+j] = buffer[k*nsamples*nchans+(i+ndump)*nchans+j];
+                if (mxdelayn[irow*ndm_per_sub+l] >= tzero) continue;
+                bufferT.add(&buffertim[(k*ndm_per_sub+l)*ndump], irow, mxdelayn[irow*ndm_per_sub+l], ndump);
             }
         }
     }
@@ -113,10 +216,7 @@ void Subband::get_subdata(vector<float> &subdata, int idm) const
     {
         for (long int j=0; j<nchans; j++)
         {
-            for (long int i=0; i<ndump; i++)
-            {
-                subdata[j*ndump+i] = bufferT[(isub*nchans+j)*nsamples+i+mxdelayn[(isub*nchans+j)*ndm_per_sub+isubdm]];
-            }
+            bufferT.copy(&subdata[j*ndump], isub*nchans+j, mxdelayn[(isub*nchans+j)*ndm_per_sub+isubdm], ndump);
         }
     }
     else
@@ -124,10 +224,7 @@ void Subband::get_subdata(vector<float> &subdata, int idm) const
         int isub_real = decodeisub[isub];
         for (long int j=0; j<nchans; j++)
         {
-            for (long int i=0; i<ndump; i++)
-            {
-                subdata[j*ndump+i] = bufferT[(isub_real*nchans+j)*nsamples+i+mxdelayn[(isub*nchans+j)*ndm_per_sub+isubdm]];
-            }
+            bufferT.copy(&subdata[j*ndump], isub_real*nchans+j, mxdelayn[(isub*nchans+j)*ndm_per_sub+isubdm], ndump);
         }
     }
 }
@@ -157,6 +254,7 @@ SubbandDedispersion::SubbandDedispersion()
 {
     mean = 0.;
     var = 0.;
+    precision = FP32;
     counter = 0;
     offset = 0;
     nsubband = 0;
@@ -164,6 +262,7 @@ SubbandDedispersion::SubbandDedispersion()
     dms = 0.;
     ddm = 0.;
     ndm = 0;
+    baseline = 0.;
     nchans = 0;
     nsamples = 0;
     tsamp = 0.;
@@ -225,8 +324,10 @@ void SubbandDedispersion::prepare(DataBuffer<float> &databuffer)
     nsamples = maxsubdelayN+ndump;
     //assert(nsamples>=2*(nsamples-ndump));
 
-    buffer.resize(nsamples*nchans, 0.);
-    bufferT.resize(nchans*nsamples, 0.);
+    bufferT.precision = precision;
+    bufferT.resize(nchans, nsamples);
+    zerolen.assign(nchans, nsamples);
+    bufferchunk.resize(nchans*ndump, 0.);
     
     /** prepare the subband */
     double ddm_sub = ddm*nsubband;
@@ -234,6 +335,7 @@ void SubbandDedispersion::prepare(DataBuffer<float> &databuffer)
     mxdelayn.resize(nchans*nsub, 0);
     
     sub.rootname = rootname;
+    sub.precision = precision;
     sub.ndump = ndump;
     sub.nchans = nsubband;
     sub.nsub = nsub;
@@ -265,7 +367,8 @@ void SubbandDedispersion::prepare(DataBuffer<float> &databuffer)
     }
 
     buffersub.resize(nsubband*nsub*ndump, 0.);
-    buffersubT.resize(nsubband*nsub*ndump, 0.);
+
+    if (baseline > 0.) buffertimbl.resize(ndm*ndump, 0.);
 
     offset = (nsamples-ndump)+(sub.nsamples-sub.ndump);
 }
@@ -274,36 +377,55 @@ void SubbandDedispersion::run(DataBuffer<float> &databuffer, long int ns)
 {
     assert(ns == ndump);
 
-    int nspace = nsamples-ns;
+    /** the new chunk replaces the oldest ndump samples, rows are pushed channel by channel */
+    transpose_pad<float>(&bufferchunk[0], &databuffer.buffer[0], ndump, nchans);
+    const float *chunk = &bufferchunk[0];
+
+    /**
+     * masked channels are zero over the chunk, their rows are not pushed once the history is zero,
+     * and they are skipped wherever the delayed window lies in the zero tail
+     */
+    bool hasmask = !databuffer.chmask.empty();
 
-    for (long int i=0; i<ns; i++)
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int j=0; j<nchans; j++)
     {
-        for (long int j=0; j<nchans; j++)
+        if (!hasmask or databuffer.chmask[j])
+        {
+            bufferT.push(j, chunk+j*ndump, ndump);
+            zerolen[j] = 0;
+        }
+        else
         {
-            buffer[(i+nspace)*nchans+j] = databuffer.buffer[i*nchans+j];
+            if (zerolen[j] < nsamples)
+                bufferT.push(j, chunk+j*ndump, ndump);
+            zerolen[j] = min(zerolen[j]+ndump, nsamples);
         }
     }
+    bufferT.advance(ndump);
 
-    transpose_pad<float>(&bufferT[0], &buffer[0], nsamples, nchans);
+    /** rows of the subband chunk that get no channel are zero */
+    submask.assign(nsub*nsubband, 0);
 
+    /** buffersub is (nsubband, nsub, ndump), the channel-major layout sub takes, no transpose in between */
     fill(buffersub.begin(), buffersub.end(), 0);
     for (long int j=0; j<nchans; j++)
     {
+        long int tzero = nsamples-zerolen[j];
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads)
 #endif
         for (long int k=0; k<nsub; k++)
         {
-            for (long int i=0; i<ndump; i++)
-            {
-                buffersub[fmap[j]*nsub*ndump+k*ndump+i] += bufferT[j*nsamples+i+mxdelayn[j*nsub+k]];
-            }
+            if (mxdelayn[j*nsub+k] >= tzero) continue;
+            bufferT.add(&buffersub[fmap[j]*nsub*ndump+k*ndump], j, mxdelayn[j*nsub+k], ndump);
+            submask[k*nsubband+fmap[j]] = 1;
         }
     }
 
-    transpose_pad<float>(&buffersubT[0], &buffersub[0], nsubband, nsub*ndump);
-
-    sub.run(buffersubT);
+    sub.run(buffersub, submask);
 
     // mean = 0.;
     // var = 0.;
@@ -321,17 +443,58 @@ void SubbandDedispersion::run(DataBuffer<float> &databuffer, long int ns)
     // var /= nsamples;
     // var -= mean*mean;
 
-    for (long int i=0; i<nspace; i++)
-    {
-        for (long int j=0; j<nchans; j++)
-        {
-            buffer[i*nchans+j] = buffer[(i+ns)*nchans+j];
-        }
-    }
-
     counter += ndump;
 }
 
+/**
+ * @brief Get the memory (in bytes) that prepare will allocate for chunks like databuffer, without allocating it
+ *
+ * @param databuffer: one chunk, ndump = databuffer.nsamples
+ * @return size_t
+ */
+size_t SubbandDedispersion::get_memory(const DataBuffer<float> &databuffer) const
+{
+    long int nd = databuffer.nsamples;
+    long int nch = databuffer.nchans;
+    long int nsubb = round(sqrt(nch));
+
+    double fmin = 1e6;
+	double fmax = 0.;
+	for (long int j=0; j<nch; j++)
+	{
+		fmax = databuffer.frequencies[j]>fmax? databuffer.frequencies[j]:fmax;
+		fmin = databuffer.frequencies[j]<fmin? databuffer.frequencies[j]:fmin;
+	}
+
+    long int maxsubdelayN = ceil(dmdelay(dms+ndm*ddm, fmax, fmin)/nsubb/databuffer.tsamp);
+    long int maxdelayN = ceil(dmdelay(dms+ndm*ddm, fmax, fmin)/databuffer.tsamp);
+
+    long int ns = maxsubdelayN+nd;
+    long int nsb = ceil((float)ndm/nsubb);
+    long int ns_sub = maxdelayN+nd;
+
+    size_t nfloat = 0;
+    /** bufferchunk */
+    nfloat += nd*nch;
+    /** buffersub */
+    nfloat += nsubb*nsb*nd;
+    /** sub.buffertim */
+    nfloat += nsb*nsubb*nd;
+    /** buffertimbl */
+    if (baseline > 0.) nfloat += ndm*nd;
+
+    size_t nint = 0;
+    /** fmap, fcnt, mxdelayn */
+    nint += nch + nsubb + nch*nsb;
+    /** sub.mxdelayn */
+    nint += nsb*nsubb*nsubb;
+
+    /** bufferT, sub.bufferT */
+    size_t nhistory = ns*nch + nsb*ns_sub*nsubb;
+
+    return sizeof(float)*nfloat + History::sizeof_sample(precision)*nhistory + sizeof(int)*nint + sizeof(double)*(nsubb + nsb*nsubb);
+}
+
 void SubbandDedispersion::preparedump()
 {
     double fmin = 1e6;
@@ -361,6 +524,25 @@ void SubbandDedispersion::preparedump()
 
 void SubbandDedispersion::rundump()
 {
+    const float *tim = &sub.buffertim[0];
+
+    /** the window is capped at the chunk, the median is approximated on blocks of 1/32 of the window */
+    if (baseline > 0.)
+    {
+        int w = max(1, (int)round(baseline/tsamp));
+        runMedianBatch(&sub.buffertim[0], &buffertimbl[0], ndm, ndump, w, max(1, w/32));
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+        for (long int i=0; i<ndm*ndump; i++)
+        {
+            buffertimbl[i] = sub.buffertim[i]-buffertimbl[i];
+        }
+
+        tim = &buffertimbl[0];
+    }
+
     for (long int k=0; k<ndm; k++)
     {
         double dm = sub.vdm[k];
@@ -370,7 +552,7 @@ void SubbandDedispersion::rundump()
 
         ofstream outfile;
         outfile.open(rootname + "_" + s_dm + ".dat", ios::binary|ios::app);
-        outfile.write((char *)(&sub.buffertim[0]+k*sub.ndump), sizeof(float)*sub.ndump);
+        outfile.write((char *)(tim+k*sub.ndump), sizeof(float)*sub.ndump);
         outfile.close();
     }
 }
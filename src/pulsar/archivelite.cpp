@@ -7,6 +7,10 @@
  */
 
 #include <string.h>
+#include <assert.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "dedisperse.h"
 #include "archivelite.h"
@@ -19,8 +23,6 @@ void sgesv_( int* n, int* nrhs, float* a, int* lda, int* ipiv,
 
 using namespace Pulsar;
 
-#define NSBLK 1024
-
 ArchiveLite::ArchiveLite()
 {
     start_mjd = 0.;
@@ -30,10 +32,15 @@ ArchiveLite::ArchiveLite()
     acc = 0.;
     dm = 0.;
     snr = 0.;
+    fref = 0.;
     nbin = 0;
     nchan = 0;
     npol = 0;
     tbin = 0.;
+    mapaddr = NULL;
+    maplen = 0;
+    mapped = NULL;
+    nmapped = 0;
 }
 
 ArchiveLite::ArchiveLite(const ArchiveLite &arch)
@@ -45,16 +52,33 @@ ArchiveLite::ArchiveLite(const ArchiveLite &arch)
     acc = arch.acc;
     dm = arch.dm;
     snr = arch.snr;
+    t2pred = arch.t2pred;
+    fref = arch.fref;
     nbin = arch.nbin;
     nchan = arch.nchan;
     npol = arch.npol;
     tbin = arch.tbin;
     frequencies = arch.frequencies;    
     profiles = arch.profiles;
+    if (arch.mapped != NULL)
+        data.assign(arch.mapped, arch.mapped+arch.profiles.size()*npol*nchan*nbin);
+    else
+        data = arch.data;
+    sub_mjd = arch.sub_mjd;
+    sub_int = arch.sub_int;
+    mapaddr = NULL;
+    maplen = 0;
+    mapped = NULL;
+    nmapped = 0;
 }
 
 ArchiveLite & ArchiveLite::operator=(const ArchiveLite &arch)
 {
+    if (this == &arch)
+        return *this;
+
+    close();
+
     start_mjd = arch.start_mjd;
     ref_epoch = arch.ref_epoch;
     f0 = arch.f0;
@@ -62,17 +86,86 @@ ArchiveLite & ArchiveLite::operator=(const ArchiveLite &arch)
     acc = arch.acc;
     dm = arch.dm;
     snr = arch.snr;
+    t2pred = arch.t2pred;
+    fref = arch.fref;
     nbin = arch.nbin;
     nchan = arch.nchan;
     npol = arch.npol;
     tbin = arch.tbin;
     frequencies = arch.frequencies;    
     profiles = arch.profiles;
+    if (arch.mapped != NULL)
+        data.assign(arch.mapped, arch.mapped+arch.profiles.size()*npol*nchan*nbin);
+    else
+        data = arch.data;
+    sub_mjd = arch.sub_mjd;
+    sub_int = arch.sub_int;
 
     return *this;
 }
 
-ArchiveLite::~ArchiveLite(){}
+ArchiveLite::~ArchiveLite()
+{
+    close();
+}
+
+void ArchiveLite::close()
+{
+    if (mapaddr != NULL)
+    {
+        munmap(mapaddr, maplen);
+        mapaddr = NULL;
+        maplen = 0;
+        mapped = NULL;
+        nmapped = 0;
+    }
+    vector<float>().swap(data);
+}
+
+/**
+ * @brief Fold into the nsub subints at offset bytes of the spill file fd instead of memory,
+ *        the file has to be large enough, the kernel writes the pages back and frees them
+ */
+bool ArchiveLite::map(int fd, long int offset, long int nsub)
+{
+    close();
+
+    if (nsub <= 0)
+        return true;
+
+    long int pagesize = sysconf(_SC_PAGESIZE);
+    long int start = offset/pagesize*pagesize;
+    maplen = (offset-start) + nsub*npol*nchan*nbin*sizeof(float);
+    mapaddr = mmap(NULL, maplen, PROT_READ|PROT_WRITE, MAP_SHARED, fd, start);
+    if (mapaddr == MAP_FAILED)
+    {
+        mapaddr = NULL;
+        maplen = 0;
+        cerr<<"Error: can not map the spill file"<<endl;
+        return false;
+    }
+
+    mapped = (float *)((char *)mapaddr+(offset-start));
+    nmapped = nsub;
+
+    return true;
+}
+
+/**
+ * @brief The slot of the subint to be folded next, the store in memory is extended by it
+ */
+float * ArchiveLite::new_subint()
+{
+    long int size = npol*nchan*nbin;
+    if (mapped != NULL)
+    {
+        assert((long int)profiles.size() < nmapped);
+        return mapped+profiles.size()*size;
+    }
+
+    data.resize((profiles.size()+1)*size);
+    return &data[profiles.size()*size];
+}
 
 void ArchiveLite::resize(int np, int nc, int nb)
 {
@@ -84,6 +177,34 @@ void ArchiveLite::resize(int np, int nc, int nb)
     sub_int.resize(npol, nchan, nbin);
 }
 
+/**
+ * @brief Append the subints of arch and leave it empty, its store is taken over
+ *        if this one has no subints and can not hold them. In spill mode the ranges
+ *        are folded into consecutive parts of the region mapped here, only the
+ *        headers are appended
+ */
+void ArchiveLite::append(ArchiveLite &arch)
+{
+    long int size = npol*nchan*nbin;
+    if (mapped != NULL)
+    {
+        profiles.insert(profiles.end(), arch.profiles.begin(), arch.profiles.end());
+    }
+    else if (profiles.empty() and data.capacity() < arch.profiles.size()*size)
+    {
+        profiles.swap(arch.profiles);
+        data.swap(arch.data);
+    }
+    else
+    {
+        profiles.insert(profiles.end(), arch.profiles.begin(), arch.profiles.end());
+        data.insert(data.end(), arch.data.begin(), arch.data.begin()+arch.profiles.size()*size);
+    }
+
+    vector<IntegrationLite>().swap(arch.profiles);
+    arch.close();
+}
+
 void ArchiveLite::prepare(DataBuffer<float> &databuffer)
 {
     frequencies = databuffer.frequencies;
@@ -101,51 +222,77 @@ void ArchiveLite::prepare(DataBuffer<float> &databuffer)
     }
 }
 
-bool ArchiveLite::runDspsr(DataBuffer<float> &databuffer)
+/**
+ * @brief Fit the phase predictor of the subint starting at sub_mjd, set the folding frequency
+ *        at its epoch, the pulse closest to the middle of the subint
+ */
+MJD ArchiveLite::fit_subint(long int nsamples, double tsamp)
+{
+    MJD start_time = sub_mjd;
+    MJD end_time = sub_mjd + (nsamples-1)*tsamp;
+
+    if (t2pred.empty())
+    {
+        MJD epoch = get_epoch(start_time, end_time, ref_epoch);
+        sub_int.ffold = get_ffold(epoch, ref_epoch);
+        predictor.fit(sub_mjd, ref_epoch, f0, f1);
+        return epoch;
+    }
+
+    /** the edges of runTRLSM reach half a sample beyond the subint */
+    predictor.fit(t2pred, sub_mjd, (nsamples+1)*tsamp, fref);
+
+    double tmid = 0.5*(nsamples-1)*tsamp;
+    double phi = predictor.get_phase(tmid);
+    double tepoch = tmid-(phi-floor(phi))/predictor.get_ffold(tmid);
+    sub_int.ffold = predictor.get_ffold(tepoch);
+
+    return start_time+tepoch;
+}
+
+bool ArchiveLite::runDspsr(const DataBuffer<float> &databuffer)
 {
     if (databuffer.counter <= 0)
         return false;
 
     sub_int.tsubint = databuffer.nsamples*databuffer.tsamp;
-    MJD start_time = sub_mjd;
-    MJD end_time = sub_mjd + (databuffer.nsamples-1)*databuffer.tsamp;
-    MJD epoch = get_epoch(start_time, end_time, ref_epoch);
+    MJD epoch = fit_subint(databuffer.nsamples, databuffer.tsamp);
     sub_int.offs_sub = (epoch-start_mjd).to_second();
     
-    double phi = 0.;
-    double f = 0.;
+    arena.reset();
+    float *sub = new_subint();
 
-    vector<int> hits(nbin, 0);
-    vector<float> profilesTPF(nbin*npol*nchan, 0.);
-    vector<float> profilesPFT(npol*nchan*nbin, 0.);
+    int *hits = arena.alloc<int>(nbin, 0);
+    float *profilesTPF = arena.alloc<float>(nbin*npol*nchan, 0.f);
+    float *profilesPFT = arena.alloc<float>(npol*nchan*nbin);
 
-    fill(hits.begin(), hits.end(), 0);
-    vector<int> binplan(databuffer.nsamples);
+    /** bin of each sample */
+    double *frac = arena.alloc<double>(databuffer.nsamples);
+    int *binplan = arena.alloc<int>(databuffer.nsamples);
+    predictor.get_bins(frac, binplan, databuffer.nsamples, 0., databuffer.tsamp, nbin);
     for (long int i=0; i<databuffer.nsamples; i++)
     {
-        if (i%NSBLK == 0)
-        {
-            phi = get_phase(sub_mjd+i*databuffer.tsamp, ref_epoch);
-            f = get_ffold(sub_mjd+(i+NSBLK*0.5-0.5)*databuffer.tsamp, ref_epoch);
-        }
-
-        phi -= floor(phi);
-		int ibin = int(phi*nbin);
+        int ibin = binplan[i]%nbin;
+        ibin = ibin<0 ? ibin+nbin:ibin;
         binplan[i] = ibin;
         hits[ibin]++;
-        phi += f*databuffer.tsamp;
     }
 
-    fill(profilesTPF.begin(), profilesTPF.end(), 0.);
+    /** masked channels are zero, their profiles stay zero */
+    databuffer.get_chranges(chranges);
+
     for (long int i=0; i<databuffer.nsamples; i++)
     {
-        for (long int j=0; j<databuffer.nchans; j++)
+        for (auto r=chranges.begin(); r!=chranges.end(); ++r)
         {
-            profilesTPF[binplan[i]*databuffer.nchans+j] += databuffer.buffer[i*databuffer.nchans+j];
+            for (long int j=r->first; j<r->second; j++)
+            {
+                profilesTPF[binplan[i]*databuffer.nchans+j] += databuffer.buffer[i*databuffer.nchans+j];
+            }
         }
     }
 
-    transpose_pad<float>(&profilesPFT[0], &profilesTPF[0], nbin, npol*nchan);
+    transpose_pad<float>(profilesPFT, profilesTPF, nbin, npol*nchan);
 
     for (long int ipol=0; ipol<npol; ipol++)
     {
@@ -158,11 +305,11 @@ bool ArchiveLite::runDspsr(DataBuffer<float> &databuffer)
             long int count = 0;
             for (long int ibin=0; ibin<nbin; ibin++)
             {
-                sub_int.data[ipol*nchan*nbin+ichan*nbin+ibin] = profilesPFT[ipol*nchan*nbin+ichan*nbin+ibin];
+                sub[ipol*nchan*nbin+ichan*nbin+ibin] = profilesPFT[ipol*nchan*nbin+ichan*nbin+ibin];
                 if (hits[ibin] != 0)
                 {
-                    sub_int.data[ipol*nchan*nbin+ichan*nbin+ibin] /= hits[ibin];
-                    mean += sub_int.data[ipol*nchan*nbin+ichan*nbin+ibin];
+                    sub[ipol*nchan*nbin+ichan*nbin+ibin] /= hits[ibin];
+                    mean += sub[ipol*nchan*nbin+ichan*nbin+ibin];
                     count++;
                 }
             }
@@ -171,14 +318,12 @@ bool ArchiveLite::runDspsr(DataBuffer<float> &databuffer)
             {
                 if (hits[ibin] == 0)
                 {
-                    sub_int.data[ipol*nchan*nbin+ichan*nbin+ibin] = mean;
+                    sub[ipol*nchan*nbin+ichan*nbin+ibin] = mean;
                 }
             }
         }
     }
 
-    sub_int.ffold = get_ffold(epoch, ref_epoch);
-    
     sub_mjd += sub_int.tsubint;
 
     profiles.push_back(sub_int);
@@ -186,139 +331,299 @@ bool ArchiveLite::runDspsr(DataBuffer<float> &databuffer)
     return true;
 }
 
-bool ArchiveLite::runTRLSM(DataBuffer<float> &databuffer)
+/**
+ * @brief Bins and weights of the samples of a TRLSM subint, sample i covers nphi[i] bins from lbin[i] on,
+ *        the first with weight w0[i], the last with w1[i] and those between with 1. W^T W is accumulated
+ *        into mxWTW, the largest nphi is returned
+ */
+long int ArchiveLite::plan_trlsm(float *mxWTW, int *lbin, int *nphi, float *w0, float *w1, long int nsamples, double tsamp)
 {
-    if (databuffer.counter <= 0)
-        return false;
+    /** weights and bins of the samples that span more than two bins, nphi <= nbin */
+    float *vWli = arena.alloc<float>(nbin);
+    int *binplan = arena.alloc<int>(nbin);
+
+    /** sample i spans the phase between the edges i and i+1, at (i-0.5)*tsamp and (i+0.5)*tsamp */
+    double *edgefrac = arena.alloc<double>(nsamples+1);
+    int *edgebin = arena.alloc<int>(nsamples+1);
+    predictor.get_bins(edgefrac, edgebin, nsamples+1, -0.5*tsamp, tsamp, nbin);
+
+    /** the phase decreases with a negative frequency, the lower edge of sample i is then i+1 */
+    int ilow = predictor.f[0] < 0 ? 1:0;
+    const int *lowbin = edgebin+ilow;
+    const int *highbin = edgebin+1-ilow;
+    const double *lowfrac = edgefrac+ilow;
+    const double *highfrac = edgefrac+1-ilow;
+
+    /** bins further apart than maxnphi-1 are not coupled in mxWTW */
+    long int maxnphi = 1;
+
+    for (long int i=0; i<nsamples; i++)
+    {
+        long int low_phin = lowbin[i];
+        long int high_phin = highbin[i];
+        double low_frac = lowfrac[i];
+        double high_frac = highfrac[i];
 
-    sub_int.tsubint = databuffer.nsamples*databuffer.tsamp;
-    MJD start_time = sub_mjd;
-    MJD end_time = sub_mjd + (databuffer.nsamples-1)*databuffer.tsamp;
-    MJD epoch = get_epoch(start_time, end_time, ref_epoch);
-    sub_int.offs_sub = (epoch-start_mjd).to_second();
-    sub_int.ffold = abs(get_ffold(epoch, ref_epoch));
+        long int n = high_phin-low_phin+1;
 
-    double phi = 0.;
-    double f = 0.;
+        assert(n<=nbin);
+        maxnphi = max(maxnphi, n);
 
-    vector<float> mxWTW(nbin*nbin, 0.);
-    vector<float> vWTd_T(nbin*databuffer.nchans, 0.);
+        long int l=low_phin%nbin;
+        l = l<0 ? l+nbin:l;
 
-    for (long int i=0; i<databuffer.nsamples; i++)
-    {
-        if (i%NSBLK == 0)
-        {
-            phi = get_phase(sub_mjd+(i-0.5)*databuffer.tsamp, ref_epoch);
-            f = get_ffold(sub_mjd+(i+NSBLK*0.5-0.5)*databuffer.tsamp, ref_epoch);
-        }
+        lbin[i] = l;
+        nphi[i] = n;
 
-        double low_phi = phi;
-        double high_phi = phi + f*databuffer.tsamp;
-        phi = high_phi;
-
-        if (low_phi > high_phi)
+        if (n == 1)
         {
-            double tmp = low_phi;
-            low_phi = high_phi;
-            high_phi = tmp;
-        }
+            w0[i] = high_frac-low_frac;
+            w1[i] = w0[i];
 
-        long int low_phin = floor(low_phi*nbin);
-        long int high_phin = floor(high_phi*nbin);
-        long int nphi = high_phin-low_phin+1;
+            mxWTW[l*nbin+l] += w0[i]*w0[i];
+        }
+        else if (n == 2)
+        {
+            w0[i] = 1.-low_frac;
+            w1[i] = high_frac;
 
-        assert(nphi<=nbin);
+            long int m = l+1<nbin ? l+1:0;
 
-        if (nphi == 1)
+            mxWTW[l*nbin+l] += w0[i]*w0[i];
+            mxWTW[l*nbin+m] += w0[i]*w1[i];
+            mxWTW[m*nbin+l] += w1[i]*w0[i];
+            mxWTW[m*nbin+m] += w1[i]*w1[i];
+        }
+        else
         {
-            float vWli0 = 1.;
+            w0[i] = 1.-low_frac;
+            w1[i] = high_frac;
+
+            fill(vWli, vWli+n, 1.);
 
-            vWli0 = (high_phi-low_phi)*nbin;
+            vWli[0] = w0[i];
+            vWli[n-1] = w1[i];
 
-            long int l=low_phin%nbin;
-            l = l<0 ? l+nbin:l;
+            for (long int p=0; p<n; p++)
             {
-                mxWTW[l*nbin+l] += vWli0*vWli0;
+                binplan[p] = (l+p)%nbin;
             }
 
-            for (long int j=0; j<databuffer.nchans; j++)
-            {       
-                vWTd_T[l*databuffer.nchans+j] += vWli0*databuffer.buffer[i*databuffer.nchans+j];
+            for (long int p=0; p<n; p++)
+            {
+                for (long int q=0; q<n; q++)
+                {
+                    mxWTW[binplan[p]*nbin+binplan[q]] += vWli[p]*vWli[q];
+                }
             }
         }
-        else if (nphi == 2)
-        {
-            float vWli0=1., vWli1=1.;
+    }
 
-            vWli0 = 1.-(low_phi*nbin-floor(low_phi*nbin));
-            vWli1 = high_phi*nbin-floor(high_phi*nbin);
+    return maxnphi;
+}
 
-            long int l=low_phin%nbin;
-            l = l<0 ? l+nbin:l;
-            long int m = high_phin%nbin;
-            m = m<0 ? m+nbin:m;
+/**
+ * @brief Solve (I + W^T W/T) x = W^T d for the nchans columns of vWTd_T (nbin, nchans), T = tspan*ffold,
+ *        the profiles are written to sub (nchans, nbin)
+ */
+void ArchiveLite::solve_trlsm(float *sub, float *mxWTW, float *vWTd_T, long int nchans, long int maxnphi, double tspan)
+{
+    for (long int l=0; l<nbin; l++)
+    {
+        for (long int m=0; m<nbin; m++)
+        {
+            mxWTW[l*nbin+m] /= (tspan*sub_int.ffold);
+        }
+        mxWTW[l*nbin+l] += 1;
+    }
 
-            mxWTW[l*nbin+l] += vWli0*vWli0;
-            mxWTW[l*nbin+m] += vWli0*vWli1;
-            mxWTW[m*nbin+l] += vWli1*vWli0;
-            mxWTW[m*nbin+m] += vWli1*vWli1;
+    /** mxWTW = I + W^T W/T is positive definite and cyclic banded, solve with Cholesky of the band */
+    float *diag = arena.alloc<float>(nbin);
+    for (long int l=0; l<nbin; l++)
+        diag[l] = mxWTW[l*nbin+l];
 
-            for (long int j=0; j<databuffer.nchans; j++)
+    if (cholesky_cyclic_band(mxWTW, nbin, maxnphi-1))
+    {
+        cholesky_solve_cyclic_band(mxWTW, nbin, maxnphi-1, vWTd_T, nchans);
+        transpose_pad<float>(sub, vWTd_T, nbin, npol*nchan);
+    }
+    else
+    {
+        /** restore the diagonal and the lower triangle from the upper one */
+        for (long int l=0; l<nbin; l++)
+        {
+            mxWTW[l*nbin+l] = diag[l];
+            for (long int m=0; m<l; m++)
             {
-                vWTd_T[l*databuffer.nchans+j] += vWli0*databuffer.buffer[i*databuffer.nchans+j];
-                vWTd_T[m*databuffer.nchans+j] += vWli1*databuffer.buffer[i*databuffer.nchans+j];
+                mxWTW[l*nbin+m] = mxWTW[m*nbin+l];
             }
         }
-        else
-        {
-            vector<float> vWli(nphi, 1.);
-            vector<int> binplan(nphi, 0);
 
-            vWli[0] = 1.-(low_phi*nbin-floor(low_phi*nbin));
-            vWli[nphi-1] = high_phi*nbin-floor(high_phi*nbin);
+        transpose_pad<float>(sub, vWTd_T, nbin, npol*nchan);
+
+        int n = nbin;
+        int nrhs = nchans;
+        int *ipiv = arena.alloc<int>(n);
+        int info;
 
-            for (long int l=0; l<nphi; l++)
+        sgesv_(&n, &nrhs, mxWTW, &n, ipiv, sub, &n, &info);
+    }
+}
+
+bool ArchiveLite::runTRLSM(const DataBuffer<float> &databuffer)
+{
+    if (databuffer.counter <= 0)
+        return false;
+
+    sub_int.tsubint = databuffer.nsamples*databuffer.tsamp;
+    MJD epoch = fit_subint(databuffer.nsamples, databuffer.tsamp);
+    sub_int.offs_sub = (epoch-start_mjd).to_second();
+    sub_int.ffold = abs(sub_int.ffold);
+
+    arena.reset();
+    float *sub = new_subint();
+
+    long int nsamples = databuffer.nsamples;
+    long int nchans = databuffer.nchans;
+
+    float *mxWTW = arena.alloc<float>(nbin*nbin, 0.f);
+    float *vWTd_T = arena.alloc<float>(nbin*nchans, 0.f);
+    int *lbin = arena.alloc<int>(nsamples);
+    int *nphi = arena.alloc<int>(nsamples);
+    float *w0 = arena.alloc<float>(nsamples);
+    float *w1 = arena.alloc<float>(nsamples);
+
+    long int maxnphi = plan_trlsm(mxWTW, lbin, nphi, w0, w1, nsamples, databuffer.tsamp);
+
+    /** masked channels are zero, their profiles stay zero */
+    databuffer.get_chranges(chranges);
+
+    for (long int i=0; i<nsamples; i++)
+    {
+        const float *x = &databuffer.buffer[i*nchans];
+        long int l = lbin[i];
+
+        if (nphi[i] == 1)
+        {
+            for (auto r=chranges.begin(); r!=chranges.end(); ++r)
             {
-                binplan[l] = (low_phin+l)%nbin;
-                binplan[l] = binplan[l]<0 ? binplan[l]+nbin:binplan[l];
+                for (long int j=r->first; j<r->second; j++)
+                {
+                    vWTd_T[l*nchans+j] += w0[i]*x[j];
+                }
             }
+        }
+        else if (nphi[i] == 2)
+        {
+            long int m = l+1<nbin ? l+1:0;
 
-            for (long int l=0; l<nphi; l++)
+            for (auto r=chranges.begin(); r!=chranges.end(); ++r)
             {
-                for (long int m=0; m<nphi; m++)
+                for (long int j=r->first; j<r->second; j++)
                 {
-                    mxWTW[binplan[l]*nbin+binplan[m]] += vWli[l]*vWli[m];
+                    vWTd_T[l*nchans+j] += w0[i]*x[j];
+                    vWTd_T[m*nchans+j] += w1[i]*x[j];
                 }
             }
-
-            for (long int l=0; l<nphi; l++)
+        }
+        else
+        {
+            for (long int p=0; p<nphi[i]; p++)
             {
-                for (long int j=0; j<databuffer.nchans; j++)
+                float w = p==0 ? w0[i]:(p==nphi[i]-1 ? w1[i]:1.f);
+                long int b = (l+p)%nbin;
+                for (auto r=chranges.begin(); r!=chranges.end(); ++r)
                 {
-                    vWTd_T[binplan[l]*databuffer.nchans+j] += vWli[l]*databuffer.buffer[i*databuffer.nchans+j];
+                    for (long int j=r->first; j<r->second; j++)
+                    {
+                        vWTd_T[b*nchans+j] += w*x[j];
+                    }
                 }
             }
         }
     }
 
-    for (long int l=0; l<nbin; l++)
+    solve_trlsm(sub, mxWTW, vWTd_T, nchans, maxnphi, nsamples*databuffer.tsamp);
+
+    sub_mjd += sub_int.tsubint;
+
+    profiles.push_back(sub_int);
+
+    return true;
+}
+
+/**
+ * @brief TRLSM of the last chunk of dedisp in direct mode, each channel is read at its own delay
+ *        from the channel-major history, the channels are independent and go to the threads
+ */
+bool ArchiveLite::runTRLSM(const DedispersionLite &dedisp, int idm)
+{
+    assert(dedisp.direct);
+    assert(dedisp.nchans == npol*nchan);
+
+    if (dedisp.counter <= 0)
+        return false;
+
+    long int nsamples = dedisp.ndump;
+    long int nchans = dedisp.nchans;
+
+    sub_int.tsubint = nsamples*dedisp.tsamp;
+    MJD epoch = fit_subint(nsamples, dedisp.tsamp);
+    sub_int.offs_sub = (epoch-start_mjd).to_second();
+    sub_int.ffold = abs(sub_int.ffold);
+
+    arena.reset();
+    float *sub = new_subint();
+
+    float *mxWTW = arena.alloc<float>(nbin*nbin, 0.f);
+    float *vWTd = arena.alloc<float>(nchans*nbin, 0.f);
+    float *vWTd_T = arena.alloc<float>(nbin*nchans);
+    int *lbin = arena.alloc<int>(nsamples);
+    int *nphi = arena.alloc<int>(nsamples);
+    float *w0 = arena.alloc<float>(nsamples);
+    float *w1 = arena.alloc<float>(nsamples);
+
+    long int maxnphi = plan_trlsm(mxWTW, lbin, nphi, w0, w1, nsamples, dedisp.tsamp);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int j=0; j<nchans; j++)
     {
-        for (long int m=0; m<nbin; m++)
+        /** channels that are zero at this delay keep zero profiles */
+        const float *x = dedisp.get_chandata(idm, j);
+        if (x == NULL) continue;
+
+        float *v = vWTd+j*nbin;
+        for (long int i=0; i<nsamples; i++)
         {
-            mxWTW[l*nbin+m] /= (databuffer.nsamples*databuffer.tsamp*sub_int.ffold);
+            long int l = lbin[i];
+
+            if (nphi[i] == 1)
+            {
+                v[l] += w0[i]*x[i];
+            }
+            else if (nphi[i] == 2)
+            {
+                long int m = l+1<nbin ? l+1:0;
+                v[l] += w0[i]*x[i];
+                v[m] += w1[i]*x[i];
+            }
+            else
+            {
+                for (long int p=0; p<nphi[i]; p++)
+                {
+                    float w = p==0 ? w0[i]:(p==nphi[i]-1 ? w1[i]:1.f);
+                    v[(l+p)%nbin] += w*x[i];
+                }
+            }
         }
-        mxWTW[l*nbin+l] += 1;
     }
 
-    transpose_pad<float>(&sub_int.data[0], &vWTd_T[0], nbin, npol*nchan);
+    transpose_pad<float>(vWTd_T, vWTd, nchans, nbin);
 
-    int n = nbin;
-    int nrhs = databuffer.nchans;
-    vector<int> ipiv(n);
-    int info;
+    solve_trlsm(sub, mxWTW, vWTd_T, nchans, maxnphi, nsamples*dedisp.tsamp);
 
-    sgesv_(&n, &nrhs, &mxWTW[0], &n, &ipiv[0], &sub_int.data[0], &n, &info);
-    
     sub_mjd += sub_int.tsubint;
 
     profiles.push_back(sub_int);
@@ -46,14 +46,20 @@ int main(int argc, const char *argv[])
 			("ndm", value<int>()->default_value(200), "Number of DM")
 			("ddplan", value<string>(), "Input ddplan file")
 			("seglen,l", value<float>()->default_value(1), "Time length per segment (s)")
+			("max-memory", value<double>()->default_value(0), "Memory cap of dedispersion (GB), the ddplan is split into sequential passes to fit in it (0 means no cap)")
+			("precision", value<string>()->default_value("float"), "Storage precision of the dedispersion history [float, fp16, bf16], fp16 and bf16 halve its memory")
+			("baseline", value<double>()->default_value(0), "Width of the running median subtracted from the dedispersed time series (s), 0 for none")
 			("ibeam,i", value<int>()->default_value(1), "Beam number")
-			("rfi,z", value<vector<string>>()->multitoken()->zero_tokens()->composing(), "RFI mitigation [[mask tdRFI fdRFI] [kadaneF tdRFI fdRFI] [kadaneT tdRFI fdRFI] [zap fl fh] [zdot] [zero]]")
+			("rfi,z", value<vector<string>>()->multitoken()->zero_tokens()->composing(), "RFI mitigation [[mask tdRFI fdRFI] [kadaneF tdRFI fdRFI] [kadaneT tdRFI fdRFI] [sk tdRFI fdRFI] [zap fl fh] [zdot] [zero]]")
 			("bandlimit", value<double>()->default_value(10), "Band limit of RFI mask (MHz)")
 			("bandlimitKT", value<double>()->default_value(10), "Band limit of RFI kadaneT (MHz)")
 			("widthlimit", value<double>()->default_value(10e-3), "Width limit of RFI kadaneF (s)")
 			("threKadaneF", value<float>()->default_value(7), "S/N threshold of KadaneF")
 			("threKadaneT", value<float>()->default_value(7), "S/N threshold of KadaneT")
+			("threSK", value<float>()->default_value(5), "Threshold of spectral kurtosis |SK-1| in unit of its standard deviation")
 			("threMask", value<float>()->default_value(3), "S/N threshold of Mask")
+			("equalize", value<string>()->default_value("chunk"), "Channel equalization [chunk, ewma, window, robust], ewma and window carry the mean and std across chunks, robust uses a streaming median and MAD")
+			("eqtime", value<double>()->default_value(10), "Time scale of the ewma, window and robust equalization (s)")
             ("rootname,o", value<string>()->default_value("J0000-00"), "Output rootname")
 			("cont", "Input files are contiguous")
 			("input,f", value<vector<string>>()->multitoken()->composing(), "Input files");
@@ -84,6 +90,13 @@ int main(int argc, const char *argv[])
 		return -1;
 	}
 
+	ChannelStatistics::Mode eqmode;
+	if (!ChannelStatistics::parse_mode(vm["equalize"].as<string>(), eqmode))
+	{
+		cerr<<"Error: unknown equalize mode "<<vm["equalize"].as<string>()<<endl;
+		return -1;
+	}
+
 	bool contiguous = vm.count("cont");
 
     string rootname = vm["rootname"].as<string>();
@@ -180,107 +193,126 @@ int main(int argc, const char *argv[])
 	long int nseg = jump[0]/tsamp;
 	long int njmp = jump[1]/tsamp;
 
-    long int ncover = 0;
+	vector<vector<PulsarSearch>> passes;
+	ndump = plan_memory(search, passes, databuf, vm["max-memory"].as<double>()*1024*1024*1024);
+	if (ndump < 0)
+	{
+		delete [] buffer;
+		delete [] psf;
+		return -1;
+	}
+	search.clear();
 
     stringstream ss_ibeam;
     ss_ibeam << "M" << setw(2) << setfill('0') << ibeam;
     string s_ibeam = ss_ibeam.str();
 
-    ncover++;
-	long int nsearch = search.size();
-	for (long int k=0; k<nsearch; k++)
-	{
-		search[k].ibeam = ibeam;
-        search[k].rootname = rootname + "_" + s_ibeam + '_' + to_string(ncover);
-		search[k].prepare(databuf);
-	}
-
 	psf[0].close();
 
 	int sumif = nifs>2? 2:nifs;
-	
-    long int jmpcont = 0;
-	long int ntot = 0;
-	long int ntot2 = 0;
-    long int count = 0;
-    long int bcnt1 = 0;
-	for (long int idxn=0; idxn<npsf; idxn++)
+
+	long int npass = passes.size();
+	for (long int ipass=0; ipass<npass; ipass++)
 	{
-		long int n = idx[idxn];
+		search.swap(passes[ipass]);
 
-		psf[n].open();
-		psf[n].primary.load(psf[n].fptr);
-		psf[n].load_mode();
-		psf[n].subint.load_header(psf[n].fptr);
+        long int ncover = 0;
+
+        ncover++;
+		long int nsearch = search.size();
+		for (long int k=0; k<nsearch; k++)
+		{
+			search[k].ibeam = ibeam;
+            search[k].rootname = rootname + "_" + s_ibeam + '_' + to_string(ncover);
+			search[k].prepare(databuf);
+		}
 
-		for (long int s=0; s<psf[n].subint.nsubint; s++)
+        long int jmpcont = 0;
+		long int ntot = 0;
+		long int ntot2 = 0;
+        long int count = 0;
+        long int bcnt1 = 0;
+		for (long int idxn=0; idxn<npsf; idxn++)
 		{
-			if (verbose)
+			long int n = idx[idxn];
+
+			psf[n].open();
+			psf[n].primary.load(psf[n].fptr);
+			psf[n].load_mode();
+			psf[n].subint.load_header(psf[n].fptr);
+
+			for (long int s=0; s<psf[n].subint.nsubint; s++)
 			{
-				cerr<<"\r\rfinish "<<setprecision(2)<<fixed<<tsamp*count<<" seconds ";
-				cerr<<"("<<100.*count/ntotal<<"%)";
-			}
+				if (verbose)
+				{
+					cerr<<"\r\rfinish "<<setprecision(2)<<fixed<<tsamp*count<<" seconds ";
+					cerr<<"("<<100.*count/ntotal<<"%)";
+				}
 
-			psf[n].subint.load_integration_data(psf[n].fptr, s, it);
+				psf[n].subint.load_integration_data(psf[n].fptr, s, it);
 #ifdef FAST
-			unsigned char *pcur = (unsigned char *)(it.data);
+				unsigned char *pcur = (unsigned char *)(it.data);
 #endif
-			for (long int i=0; i<it.nsblk; i++)
-			{
-                count++;
-                if (ntot == nseg)
-                {
-                    if (jmpcont++ < njmp)
+				for (long int i=0; i<it.nsblk; i++)
+				{
+                    count++;
+                    if (ntot == nseg)
                     {
-                        pcur += it.npol*it.nchan;
-                        continue;
-                    }
+                        if (jmpcont++ < njmp)
+                        {
+                            pcur += it.npol*it.nchan;
+                            continue;
+                        }
                    
-                    ntot = 0;
-                    jmpcont = 0;
-
-                    ncover++;
-                    for (long int k=0; k<nsearch; k++)
-	                {
-                        search[k].dedisp.rootname = rootname + "_" + s_ibeam + '_' + to_string(ncover);
-                        search[k].dedisp.prepare(search[k].rfi);
-                        search[k].dedisp.preparedump();
-	                }
-                }
-
-				memset(buffer, 0, sizeof(float)*nchans);
-				long int m = 0;
-				for (long int k=0; k<sumif; k++)
-				{
-					for (long int j=0; j<nchans; j++)
+                        ntot = 0;
+                        jmpcont = 0;
+
+                        ncover++;
+                        for (long int k=0; k<nsearch; k++)
+		                {
+                            search[k].dedisp.rootname = rootname + "_" + s_ibeam + '_' + to_string(ncover);
+                            search[k].dedisp.prepare(search[k].rfi);
+                            search[k].dedisp.preparedump();
+		                }
+                    }
+
+					memset(buffer, 0, sizeof(float)*nchans);
+					long int m = 0;
+					for (long int k=0; k<sumif; k++)
 					{
-						buffer[j] +=  pcur[m++];
+						for (long int j=0; j<nchans; j++)
+						{
+							buffer[j] +=  pcur[m++];
+						}
 					}
-				}
 
-				memcpy(&databuf.buffer[0]+bcnt1*nchans, buffer, sizeof(float)*1*nchans);
-                bcnt1++;
-                ntot++;
+					memcpy(&databuf.buffer[0]+bcnt1*nchans, buffer, sizeof(float)*1*nchans);
+                    bcnt1++;
+                    ntot++;
 
-				if (ntot%ndump == 0)
-				{
-					for (auto sp=search.begin(); sp!=search.end(); ++sp)
+					if (ntot%ndump == 0)
 					{
-						(*sp).run(databuf);
+						for (auto sp=search.begin(); sp!=search.end(); ++sp)
+						{
+							(*sp).run(databuf);
+						}
+                        bcnt1 = 0;
 					}
-                    bcnt1 = 0;
-				}
 
-				pcur += it.npol*it.nchan;
+					pcur += it.npol*it.nchan;
+				}
 			}
+			psf[n].close();
 		}
-		psf[n].close();
-	}
 
-	if (verbose)
-	{
-		cerr<<"\r\rfinish "<<setprecision(2)<<fixed<<tsamp*count<<" seconds ";
-		cerr<<"("<<100.*count/ntotal<<"%)"<<endl;
+		if (verbose)
+		{
+			cerr<<"\r\rfinish "<<setprecision(2)<<fixed<<tsamp*count<<" seconds ";
+			cerr<<"("<<100.*count/ntotal<<"%)"<<endl;
+		}
+
+		search.clear();
+		search.shrink_to_fit();
 	}
 
 	delete [] buffer;
@@ -6,6 +6,8 @@
  * @desc [description]
  */
 
+#include <map>
+
 #include "dedispersionlite.h"
 #include "dedisperse.h"
 
@@ -14,6 +16,8 @@ using namespace Pulsar;
 DedispersionLite::DedispersionLite()
 {
     nsubband = 0;
+    direct = false;
+    ndm = 0;
     counter = 0;
     offset = 0;
     nchans = 0;
@@ -37,9 +41,6 @@ void DedispersionLite::prepare(DataBuffer<float> &databuffer)
     int nch = ceil(nchans/nsubband);
     frequencies_sub.resize(nsubband, 0.);
 
-    buffertim.resize(vdm.size()*ndump, 0.);
-    buffersub.resize(vdm.size()*ndump*nsubband, 0.);
-
     vector<int> fcnt(nsubband, 0);
     for (long int j=0; j<nchans; j++)
     {
@@ -60,18 +61,58 @@ void DedispersionLite::prepare(DataBuffer<float> &databuffer)
 	}
     long int maxdelayn = ceil(dmdelay(*max_element(vdm.begin(), vdm.end()), fmax, fmin)/tsamp);
     nsamples = ceil(1.*maxdelayn/ndump)*ndump + ndump;
-    buffer.resize(nsamples*nchans, 0.);
+    bufferT.resize(nchans*nsamples, 0.);
+    bufferchunk.resize(nchans*ndump, 0.);
+    zerolen.assign(nchans, nsamples);
+
+    /** dms whose delays round to the same samples in every channel are dedispersed once */
+    map<vector<long int>, int> delaymap;
+    vector<long int> delay(nchans, 0);
+    vector<long int> delays;
+    dmidx.resize(vdm.size(), 0);
+    for (long int k=0; k<(long int)vdm.size(); k++)
+    {
+        for (long int j=0; j<nchans; j++)
+        {
+            delay[j] = round(dmdelay(vdm[k], fmax, frequencies[j])/tsamp);
+        }
+
+        auto it = delaymap.find(delay);
+        if (it != delaymap.end())
+        {
+            dmidx[k] = it->second;
+        }
+        else
+        {
+            dmidx[k] = delaymap.size();
+            delaymap[delay] = dmidx[k];
+            delays.insert(delays.end(), delay.begin(), delay.end());
+        }
+    }
+    ndm = delaymap.size();
 
-    delayn.resize(vdm.size()*nchans, 0);
-    int ndm = vdm.size();
+    delayn.resize(ndm*nchans, 0);
     for (long int j=0; j<nchans; j++)
     {
         for (long int k=0; k<ndm; k++)
         {
-            delayn[j*ndm+k] = round(dmdelay(vdm[k], fmax, frequencies[j])/tsamp);
+            delayn[j*ndm+k] = delays[k*nchans+j];
         }
     }
 
+    buffertim.resize(ndm*ndump, 0.);
+    buffersubT.resize(ndm*nsubband*ndump, 0.);
+    submask.assign(ndm*nsubband, 1);
+
+    subdata.resize(ndm);
+    for (long int k=0; k<ndm; k++)
+    {
+        subdata[k].resize(ndump, nsubband);
+        subdata[k].tsamp = tsamp;
+        subdata[k].frequencies = frequencies_sub;
+        subdata[k].counter = 0;
+    }
+
     offset = nsamples-ndump;
 }
 
@@ -81,50 +122,70 @@ void DedispersionLite::run(DataBuffer<float> &databuffer)
 
     int nspace = nsamples-ndump;
 
-    for (long int i=0; i<ndump; i++)
+    /** masked channels are zero over the chunk, they are skipped wherever the delayed window lies in the zero tail */
+    for (long int j=0; j<nchans; j++)
     {
-        for (long int j=0; j<nchans; j++)
-        {
-            buffer[(i+nspace)*nchans+j] = databuffer.buffer[i*nchans+j];
-        }
+        if (databuffer.chmask.empty() or databuffer.chmask[j])
+            zerolen[j] = 0;
+        else
+            zerolen[j] = min(zerolen[j]+ndump, (long int)nsamples);
     }
 
-    databuffer.close();
+    /** the history is kept channel-major, only the new chunk is transposed */
+    transpose_pad<float>(&bufferchunk[0], &databuffer.buffer[0], ndump, nchans);
+    const float *chunk = &bufferchunk[0];
 
-    vector<float> bufferT(nchans*nsamples, 0.);
+    /** the oldest chunk is dropped before the new one is appended, so that the window stays in bufferT for the folders */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int j=0; j<nchans; j++)
+    {
+        memmove(&bufferT[j*nsamples], &bufferT[j*nsamples+ndump], sizeof(float)*nspace);
+        memcpy(&bufferT[j*nsamples+nspace], chunk+j*ndump, sizeof(float)*ndump);
+    }
 
-    transpose_pad<float>(&bufferT[0], &buffer[0], nsamples, nchans);
+    databuffer.close();
 
-    int ndm = vdm.size();
-    int nch = ceil(nchans/nsubband);
+    if (direct)
+    {
+        counter += ndump;
+        return;
+    }
 
-    vector<float> buffersubT(nsubband*vdm.size()*ndump, 0.);
+    int nch = ceil(nchans/nsubband);
 
+    fill(buffersubT.begin(), buffersubT.end(), 0.);
     fill(buffertim.begin(), buffertim.end(), 0.);
+    fill(submask.begin(), submask.end(), 0);
 
     for (long int j=0; j<nchans; j++)
     {
+        long int tzero = nsamples-zerolen[j];
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads)
 #endif
         for (long int k=0; k<ndm; k++)
         {
+            if (delayn[j*ndm+k] >= tzero) continue;
+            submask[k*nsubband+j/nch] = 1;
             for (long int i=0; i<ndump; i++)
             {
-                buffersubT[(j/nch)*ndm*ndump+k*ndump+i] += bufferT[j*nsamples+i+delayn[j*ndm+k]];
+                buffersubT[(k*nsubband+j/nch)*ndump+i] += bufferT[j*nsamples+i+delayn[j*ndm+k]];
                 buffertim[k*ndump+i] += bufferT[j*nsamples+i+delayn[j*ndm+k]];
             }
         }
     }
-    
-    transpose_pad<float>(&buffersub[0], &buffersubT[0], nsubband, ndm*ndump);
 
-    for (long int i=0; i<nspace; i++)
+    /** the subband data are transposed once per distinct dm and shared by the candidates */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int k=0; k<ndm; k++)
     {
-        for (long int j=0; j<nchans; j++)
-        {
-            buffer[i*nchans+j] = buffer[(i+ndump)*nchans+j];
-        }
+        transpose_pad<float>(&subdata[k].buffer[0], &buffersubT[0]+k*nsubband*ndump, nsubband, ndump);
+        subdata[k].chmask.assign(submask.begin()+k*nsubband, submask.begin()+(k+1)*nsubband);
+        subdata[k].counter += ndump;
     }
 
     counter += ndump;
@@ -165,23 +165,37 @@ void GridSearch::prepare(ArchiveLite &arch)
     frequencies = arch.frequencies;
     ffold.resize(nsubint, 0.);
     tsuboff.resize(nsubint, 0.);
-    profiles.resize(nsubint*nchan*nbin, 0.);
 
     double tcentre = (arch.ref_epoch-arch.start_mjd).to_second();
 
-    int npol = arch.npol;
     for (long int l=0; l<nsubint; l++)
     {
         tsuboff[l] = arch.profiles[l].offs_sub - tcentre;
         ffold[l] = arch.profiles[l].ffold;
+    }
 
-        for (long int k=0; k<npol; k++)
+    int npol = arch.npol;
+    if (npol == 1 and !arch.spilled())
+    {
+        /** the store of arch is already (nsubint, nchan, nbin), take it over */
+        profiles.swap(arch.data);
+        vector<float>().swap(arch.data);
+        profiles.resize(nsubint*nchan*nbin);
+    }
+    else
+    {
+        const float *data = arch.get_data();
+        profiles.assign(nsubint*nchan*nbin, 0.);
+        for (long int l=0; l<nsubint; l++)
         {
-            for (long int j=0; j<nchan; j++)
+            for (long int k=0; k<npol; k++)
             {
-                for (long int i=0; i<nbin; i++)
+                for (long int j=0; j<nchan; j++)
                 {
-                   profiles[l*nchan*nbin+j*nbin+i] += arch.profiles[l].data[k*nchan*nbin+j*nbin+i];
+                    for (long int i=0; i<nbin; i++)
+                    {
+                       profiles[l*nchan*nbin+j*nbin+i] += data[l*npol*nchan*nbin+k*nchan*nbin+j*nbin+i];
+                    }
                 }
             }
         }
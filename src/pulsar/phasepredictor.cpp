@@ -0,0 +1,137 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-13 10:05:21
+ * @modify date 2020-11-14 15:32:08
+ * @desc spin phase of a subint, expanded about its start so that the samples are evaluated in double
+ */
+
+#include <math.h>
+#include <assert.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "phasepredictor.h"
+
+using namespace Pulsar;
+
+PhasePredictor::PhasePredictor()
+{
+    tpiece = 0.;
+    phi0.resize(1, 0.);
+    f.resize(1, 0.);
+    fdot.resize(1, 0.);
+}
+
+PhasePredictor::~PhasePredictor(){}
+
+/**
+ * @brief Expand the phase about start, the only long double arithmetic of a subint
+ */
+void PhasePredictor::fit(MJD start, MJD &ref_epoch, double f0, double f1)
+{
+    long double t = (start-ref_epoch).to_second();
+    long double phi = f0*t + 0.5*f1*t*t;
+
+    tpiece = 0.;
+    phi0.resize(1);
+    f.resize(1);
+    fdot.resize(1);
+
+    phi0[0] = phi - floorl(phi);
+    f[0] = f0 + f1*t;
+    fdot[0] = f1;
+}
+
+/**
+ * @brief Interpolate the tempo2 predictor at freq (MHz) over [0, tspan] after start by quadratic pieces
+ *        through the phases at the start, middle and end of each piece
+ */
+void PhasePredictor::fit(const T2Predictor &t2pred, MJD start, double tspan, double freq)
+{
+    long double base = floorl(t2pred.get_phase(start, freq));
+
+    tpiece = PHASE_PIECE;
+    long int npiece = ceil(tspan/tpiece);
+    npiece = npiece<1 ? 1:npiece;
+    phi0.resize(npiece);
+    f.resize(npiece);
+    fdot.resize(npiece);
+
+    double h = tpiece;
+    for (long int p=0; p<npiece; p++)
+    {
+        double p0 = t2pred.get_phase(start+p*h, freq)-base;
+        double p1 = t2pred.get_phase(start+(p+0.5)*h, freq)-base;
+        double p2 = t2pred.get_phase(start+(p+1)*h, freq)-base;
+
+        phi0[p] = p0;
+        f[p] = (-3.*p0+4.*p1-p2)/h;
+        fdot[p] = 4.*(p0-2.*p1+p2)/(h*h);
+    }
+}
+
+/**
+ * @brief x = a0+(a1+a2*t)*t at t0+k*dt for k<n
+ */
+static void get_bins_quadratic(double *frac, int *ibin, long int n, double t0, double dt, double a0, double a1, double a2)
+{
+    long int k = 0;
+#ifdef __AVX2__
+    __m256d va0 = _mm256_set1_pd(a0);
+    __m256d va1 = _mm256_set1_pd(a1);
+    __m256d va2 = _mm256_set1_pd(a2);
+    __m256d vt0 = _mm256_set1_pd(t0);
+    __m256d vdt = _mm256_set1_pd(dt);
+    __m256d vk = _mm256_set_pd(3., 2., 1., 0.);
+    __m256d v4 = _mm256_set1_pd(4.);
+    for (; k+4<=n; k+=4)
+    {
+        __m256d t = _mm256_add_pd(vt0, _mm256_mul_pd(vk, vdt));
+        __m256d x = _mm256_add_pd(va0, _mm256_mul_pd(_mm256_add_pd(va1, _mm256_mul_pd(va2, t)), t));
+        __m256d fl = _mm256_floor_pd(x);
+        _mm256_storeu_pd(frac+k, _mm256_sub_pd(x, fl));
+        _mm_storeu_si128((__m128i *)(ibin+k), _mm256_cvtpd_epi32(fl));
+        vk = _mm256_add_pd(vk, v4);
+    }
+#endif
+    for (; k<n; k++)
+    {
+        double t = t0 + k*dt;
+        double x = a0 + (a1 + a2*t)*t;
+        double fl = floor(x);
+        frac[k] = x - fl;
+        ibin[k] = fl;
+    }
+}
+
+/**
+ * @brief Phase bins at t0+k*dt for k<n, x = phase*nbin is split into ibin = floor(x), which is not wrapped into [0,nbin),
+ *        and frac = x-ibin in [0,1)
+ */
+void PhasePredictor::get_bins(double *frac, int *ibin, long int n, double t0, double dt, int nbin) const
+{
+    assert(fabs(get_phase(t0+n*dt)*nbin) < 2147483647.);
+
+    long int npiece = phi0.size();
+    long int kstart = 0;
+    for (long int p=0; p<npiece; p++)
+    {
+        long int kend = n;
+        if (p < npiece-1)
+        {
+            kend = ceil(((p+1)*tpiece-t0)/dt);
+            kend = kend<kstart ? kstart:kend;
+            kend = kend>n ? n:kend;
+        }
+
+        double a0 = phi0[p]*nbin;
+        double a1 = f[p]*nbin;
+        double a2 = 0.5*fdot[p]*nbin;
+        get_bins_quadratic(frac+kstart, ibin+kstart, kend-kstart, t0-p*tpiece+kstart*dt, dt, a0, a1, a2);
+
+        kstart = kend;
+    }
+}
@@ -15,6 +15,8 @@
 #include <iomanip>
 #include <string.h>
 #include <utility>
+#include <algorithm>
+#include <unistd.h>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp> 
 
@@ -29,9 +31,8 @@
 #include "archivelite.h"
 #include "dedispersionlite.h"
 #include "databuffer.h"
-#include "downsample.h"
+#include "preprocess.h"
 #include "rfi.h"
-#include "equalize.h"
 #include "psrfits.h"
 #include "mjd.h"
 #include "utils.h"
@@ -44,6 +45,8 @@ unsigned int num_threads;
 bool dumptim=false;
 
 void produce(variables_map &vm, Pulsar::DedispersionLite &dedisp, vector<Pulsar::ArchiveLite> &folder);
+void fold(const Pulsar::DedispersionLite &dedisp, vector<Pulsar::ArchiveLite> &folder, bool dspsr);
+int adapt_nbin(double f0, double tsamp, int nbinmax);
 
 int main(int argc, const char *argv[])
 {
@@ -68,8 +71,11 @@ int main(int argc, const char *argv[])
 			("noplot", "Do not generate figures")
 			("noarch", "Do not generate archives")
 			("candfile", value<string>(), "Input cand file")
+			("pred", value<vector<string>>()->multitoken()->composing(), "Input tempo2 predictor files, one pulsar each, folded instead of the candidates")
+			("par", value<vector<string>>()->multitoken()->composing(), "Input par files in the order of the predictors, for the DM and the archives")
 			("template", value<string>(), "Input fold template file")
 			("nbin,b", value<int>()->default_value(64), "Number of bins per period")
+			("autonbin", "Choose the number of bins of each candidate, the largest power of two within P/tsamp and --nbin")
 			("tsubint,L", value<double>()->default_value(1), "Time length per integration (s)")
 			("nsubband,n", value<int>()->default_value(32), "Number of subband")
 			("srcname", value<string>()->default_value("PSRJ0000+00"), "Souce name")
@@ -79,7 +85,7 @@ int main(int argc, const char *argv[])
 			("ra", value<double>()->default_value(0), "RA (hhmmss.s)")
 			("dec", value<double>()->default_value(0), "DEC (ddmmss.s)")
 			("clfd", value<double>()->default_value(-1), "CLFD q value, if q<=0, CLFD will not be applied")
-			("rfi,z", value<vector<string>>()->multitoken()->zero_tokens()->composing(), "RFI mitigation [[mask tdRFI fdRFI] [kadaneF tdRFI fdRFI] [kadaneT tdRFI fdRFI] [zap fl fh] [zdot] [zero]]")
+			("rfi,z", value<vector<string>>()->multitoken()->zero_tokens()->composing(), "RFI mitigation [[mask tdRFI fdRFI] [kadaneF tdRFI fdRFI] [kadaneT tdRFI fdRFI] [sk tdRFI fdRFI] [zap fl fh] [zdot] [zero]]")
 			("bandlimit", value<double>()->default_value(10), "Band limit of RFI mask (MHz)")
 			("bandlimitKT", value<double>()->default_value(10), "Band limit of RFI kadaneT (MHz)")
 			("widthlimit", value<double>()->default_value(10e-3), "Width limit of RFI kadaneF (s)")
@@ -87,11 +93,16 @@ int main(int argc, const char *argv[])
 			("fdRFI", value<int>()->default_value(1), "Frequency downsample of RFI")
 			("threKadaneF", value<float>()->default_value(7), "S/N threshold of KadaneF")
 			("threKadaneT", value<float>()->default_value(7), "S/N threshold of KadaneT")
+			("threSK", value<float>()->default_value(5), "Threshold of spectral kurtosis |SK-1| in unit of its standard deviation")
 			("threMask", value<float>()->default_value(10), "S/N threshold of Mask")
+			("equalize", value<string>()->default_value("chunk"), "Channel equalization [chunk, ewma, window, robust], ewma and window carry the mean and std across chunks, robust uses a streaming median and MAD")
+			("eqtime", value<double>()->default_value(10), "Time scale of the ewma, window and robust equalization (s)")
             ("render", "Using new folding algorithm (deprecated, used by default)")
 			("dspsr", "Using dspsr folding algorithm")
 			("rootname,o", value<string>()->default_value("J0000-00"), "Output rootname")
 			("cont", "Input files are contiguous")
+			("nrange", value<int>()->default_value(1), "Number of time ranges that are read, dedispersed and folded in parallel, only with --equalize chunk")
+			("spill", value<string>(), "Fold into a scratch file in this directory instead of memory, for many candidates")
 			("input,f", value<vector<string>>()->multitoken()->composing(), "Input files");
 
     positional_options_description pos_desc;
@@ -124,6 +135,20 @@ int main(int argc, const char *argv[])
 		return -1;
 	}
 
+	ChannelStatistics::Mode eqmode;
+	if (!ChannelStatistics::parse_mode(vm["equalize"].as<string>(), eqmode))
+	{
+		cerr<<"Error: unknown equalize mode "<<vm["equalize"].as<string>()<<endl;
+		return -1;
+	}
+
+	/** the ewma, window and robust statistics carry over chunks, a range would restart them */
+	if (eqmode != ChannelStatistics::CHUNK and vm["nrange"].as<int>() > 1)
+	{
+		cerr<<"Error: nrange > 1 needs --equalize chunk"<<endl;
+		return -1;
+	}
+
 	int scale = vm["scale"].as<int>();
 	bool nosearch = vm.count("nosearch");
 	bool noplot = vm.count("noplot");
@@ -239,7 +264,7 @@ int main(int argc, const char *argv[])
         rfi_opts = vm["rfi"].as<vector<string>>();
         for (auto opt=rfi_opts.begin(); opt!=rfi_opts.end(); ++opt)
         {
-            if (*opt=="mask" or *opt=="kadaneF" or *opt=="kadaneT")
+            if (*opt=="mask" or *opt=="kadaneF" or *opt=="kadaneT" or *opt=="sk")
             {
                 vector<string> temp{*opt, *(opt+1), *(opt+2)};       
                 rfilist.push_back(temp);
@@ -265,6 +290,7 @@ int main(int argc, const char *argv[])
 	int fdRFI = vm["fdRFI"].as<int>();
     float threKadaneF = vm["threKadaneF"].as<float>();
     float threKadaneT = vm["threKadaneT"].as<float>();
+    float threSK = vm["threSK"].as<float>();
     float threMask = vm["threMask"].as<float>();
 
 	Integration it;
@@ -274,8 +300,6 @@ int main(int argc, const char *argv[])
     double tsamp = psf[0].subint.tbin;
     int nifs = it.npol;
 
-	float *buffer = new float [nchans];
-
     long int ndump = (int)(vm["tsubint"].as<double>()/tsamp)/td*td;
 
 	DataBuffer<float> databuf(ndump, nchans);
@@ -285,24 +309,25 @@ int main(int argc, const char *argv[])
 	long int nstart = jump[0]/tsamp;
 	long int nend = ntotal-jump[1]/tsamp;
 
-	Downsample downsample;
-	downsample.td = td;
-    downsample.fd = fd;
-    downsample.prepare(databuf);
-	downsample.close();
-
-	Equalize equalize;
-	equalize.prepare(downsample);
-	equalize.close();
+	Preprocess preprocess;
+	preprocess.td = td;
+    preprocess.fd = fd;
+	preprocess.stats.mode = eqmode;
+	preprocess.stats.timescale = vm["eqtime"].as<double>();
+    preprocess.prepare(databuf);
+	preprocess.zap(zaplist);
+	preprocess.close();
 
     RFI rfi;
-	rfi.prepare(equalize);
+	rfi.prepare(preprocess);
 	rfi.close();
     
     Pulsar::DedispersionLite dedisp;
 	vector<Pulsar::ArchiveLite> folder;
 	produce(vm, dedisp, folder);
     dedisp.prepare(rfi);
+	/** a single candidate with a subband per channel is folded from the delayed channels, without forming subbands */
+	dedisp.direct = (folder.size() == 1 and dedisp.nsubband == dedisp.nchans and !vm.count("dspsr"));
 
     DataBuffer<float> subdata;
     dedisp.get_subdata(subdata, 0);
@@ -313,7 +338,16 @@ int main(int argc, const char *argv[])
 	{
 		folder[k].start_mjd = tstarts[idx[0]]+(ceil(1.*dedisp.offset/ndump)*ndump-dedisp.offset)*tsamp*td;
 		folder[k].ref_epoch = tstarts[idx[0]]+(ntotal*tsamp/2.);
-        folder[k].resize(1, subdata.nchans, folder[k].nbin);
+		folder[k].fref = *max_element(dedisp.frequencies.begin(), dedisp.frequencies.end());
+		if (!folder[k].t2pred.empty())
+		{
+			/** f0 and f1 of the predictor at the reference epoch, the search of gridsearch starts there */
+			folder[k].f0 = folder[k].t2pred.get_ffold(folder[k].ref_epoch, folder[k].fref);
+			folder[k].f1 = (folder[k].t2pred.get_ffold(folder[k].ref_epoch+1., folder[k].fref)-folder[k].t2pred.get_ffold(folder[k].ref_epoch-1., folder[k].fref))/2.;
+		}
+		if (vm.count("autonbin"))
+			folder[k].nbin = adapt_nbin(folder[k].f0, subdata.tsamp, vm["nbin"].as<int>());
+		folder[k].resize(1, subdata.nchans, folder[k].nbin);
 		folder[k].prepare(subdata);
         folder[k].dm = dedisp.vdm[k];
 	}
@@ -321,139 +355,240 @@ int main(int argc, const char *argv[])
     psf[0].close();
 
     int sumif = nifs>2? 2:nifs;
-	
-	long int ntot = 0;
-	long int ntot2 = 0;
-	long int count = 0;
-    long int bcnt1 = 0;
-	for (long int idxn=0; idxn<npsf; idxn++)
+
+	/**
+	 * @brief The chunks are divided into nrange time ranges, each is read, preprocessed, dedispersed and folded
+	 *        by its own copy of the stages, a range reads again the nlag chunks of the dm delay after its end,
+	 *        the subints of the ranges are merged in order
+	 */
+	long int nchunk = (min(nend+1, ntotal)-nstart)/ndump;
+	long int nlag = dedisp.offset/dedisp.ndump;
+	long int nrange = vm["nrange"].as<int>();
+	nrange = nrange>nchunk ? nchunk:nrange;
+	nrange = nrange<1 ? 1:nrange;
+
+	/**
+	 * @brief In spill mode each candidate folds into its own page aligned region of a scratch file,
+	 *        which is unlinked at once, the kernel writes the subints back and frees their pages
+	 */
+	int spillfd = -1;
+	vector<long int> spilloffs(ncand+1, 0);
+	if (vm.count("spill"))
 	{
-		long int n = idx[idxn];
+		long int pagesize = sysconf(_SC_PAGESIZE);
+		for (long int k=0; k<ncand; k++)
+		{
+			long int size = nchunk*folder[k].npol*folder[k].nchan*folder[k].nbin*sizeof(float);
+			spilloffs[k+1] = spilloffs[k]+(size+pagesize-1)/pagesize*pagesize;
+		}
 
-		psf[n].open();
-		psf[n].primary.load(psf[n].fptr);
-		psf[n].load_mode();
-		psf[n].subint.load_header(psf[n].fptr);
+		string fname = vm["spill"].as<string>()+"/psrfold_spill_XXXXXX";
+		vector<char> tmpl(fname.begin(), fname.end());
+		tmpl.push_back('\0');
+		spillfd = mkstemp(&tmpl[0]);
+		if (spillfd < 0 or unlink(&tmpl[0]) != 0 or ftruncate(spillfd, spilloffs[ncand]) != 0)
+		{
+			cerr<<"Error: can not create the spill file in "<<vm["spill"].as<string>()<<endl;
+			exit(-1);
+		}
+	}
+
+	vector<vector<Pulsar::ArchiveLite>> folders(nrange, folder);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1) if(nrange > 1)
+#endif
+	for (long int r=0; r<nrange; r++)
+	{
+		long int cstart = r*nchunk/nrange;
+		long int cend = (r+1)*nchunk/nrange;
+		long int rstart = nstart+cstart*ndump;
+		long int rend = nstart+min(cend+nlag, nchunk)*ndump;
 
-		for (long int s=0; s<psf[n].subint.nsubint; s++)
+		Psrfits *psf_t = new Psrfits [npsf];
+		for (long int i=0; i<npsf; i++)
 		{
-			if (verbose)
+			psf_t[i].filename = fnames[i];
+		}
+		Integration it_t;
+		float *buffer_t = new float [nchans];
+
+		DataBuffer<float> databuf_t = databuf;
+		Preprocess preprocess_t = preprocess;
+		RFI rfi_t = rfi;
+		Pulsar::DedispersionLite dedisp_t = dedisp;
+		vector<Pulsar::ArchiveLite> &folder_t = folders[r];
+		/** sub_mjd is advanced subint by subint as in a single range, the phases do not depend on nrange */
+		for (long int k=0; k<ncand; k++)
+		{
+			for (long int c=0; c<cstart; c++)
+				folder_t[k].sub_mjd += dedisp.ndump*dedisp.tsamp;
+			/** one subint per chunk */
+			if (spillfd >= 0)
 			{
-				cerr<<"\r\rfinish "<<setprecision(2)<<fixed<<tsamp*count<<" seconds ";
-				cerr<<"("<<100.*count/ntotal<<"%)";
+				long int size = folder_t[k].npol*folder_t[k].nchan*folder_t[k].nbin*sizeof(float);
+				if (!folder_t[k].map(spillfd, spilloffs[k]+cstart*size, cend-cstart))
+					exit(-1);
 			}
+			folder_t[k].reserve(cend-cstart);
+		}
+		long int nfold = 0;
 
-			psf[n].subint.load_integration_data(psf[n].fptr, s, it);
-#ifdef FAST
-			unsigned char *pcur = (unsigned char *)(it.data);
-#endif
-			for (long int i=0; i<it.nsblk; i++)
+		long int ntot = 0;
+		long int ntot2 = 0;
+		long int count = 0;
+	    long int bcnt1 = 0;
+		for (long int idxn=0; idxn<npsf; idxn++)
+		{
+			long int n = idx[idxn];
+
+			if (count >= rend) break;
+
+			psf_t[n].open();
+			psf_t[n].primary.load(psf_t[n].fptr);
+			psf_t[n].load_mode();
+			psf_t[n].subint.load_header(psf_t[n].fptr);
+
+			for (long int s=0; s<psf_t[n].subint.nsubint; s++)
 			{
-				count++;
-				if (count-1<nstart or count-1>nend)
+				if (count+psf_t[n].subint.nsblk <= rstart)
 				{
-					pcur += it.npol*it.nchan;
+					count += psf_t[n].subint.nsblk;
 					continue;
 				}
+				if (count >= rend) break;
 
-				memset(buffer, 0, sizeof(float)*nchans);
-				long int m = 0;
-				for (long int k=0; k<sumif; k++)
+				if (verbose and r == 0)
+				{
+					cerr<<"\r\rfinish "<<setprecision(2)<<fixed<<tsamp*count<<" seconds ";
+					cerr<<"("<<100.*count/ntotal<<"%)";
+				}
+
+				psf_t[n].subint.load_integration_data(psf_t[n].fptr, s, it_t);
+#ifdef FAST
+				unsigned char *pcur = (unsigned char *)(it_t.data);
+#endif
+				for (long int i=0; i<it_t.nsblk; i++)
 				{
-					for (long int j=0; j<nchans; j++)
+					count++;
+					if (count-1<rstart or count-1>=rend)
 					{
-						buffer[j] +=  pcur[m++];
+						pcur += it_t.npol*it_t.nchan;
+						continue;
 					}
-				}
 
-                memcpy(&databuf.buffer[0]+bcnt1*nchans, buffer, sizeof(float)*1*nchans);
-                bcnt1++;
-				ntot++;
+					memset(buffer_t, 0, sizeof(float)*nchans);
+					long int m = 0;
+					for (long int k=0; k<sumif; k++)
+					{
+						for (long int j=0; j<nchans; j++)
+						{
+							buffer_t[j] +=  pcur[m++];
+						}
+					}
 
-				if (ntot%ndump == 0)
-				{
-					downsample.open();
-    				downsample.run(databuf);
-					databuf.close();
-
-					equalize.open();
-    				equalize.run(downsample);
-					downsample.close();
-
-					rfi.open();
-					rfi.zap(equalize, zaplist);
-					equalize.close();
-
-					for (auto irfi = rfilist.begin(); irfi!=rfilist.end(); ++irfi)
-                    {
-                        if ((*irfi)[0] == "mask")
-                        {
-                            rfi.mask(rfi, threMask, stoi((*irfi)[1]), stoi((*irfi)[2]));
-                        }
-                        else if ((*irfi)[0] == "kadaneF")
-                        {
-                            rfi.kadaneF(rfi, threKadaneF*threKadaneF, widthlimit, stoi((*irfi)[1]), stoi((*irfi)[2]));
-                        }
-                        else if ((*irfi)[0] == "kadaneT")
-                        {
-                            rfi.kadaneT(rfi, threKadaneT*threKadaneT, bandlimitKT, stoi((*irfi)[1]), stoi((*irfi)[2]));
-                        }
-                        else if ((*irfi)[0] == "zdot")
-                        {
-                            rfi.zdot(rfi);
-                        }
-                        else if ((*irfi)[0] == "zero")
-                        {
-                            rfi.zero(rfi);
-                        }
-                    }
-
-                    dedisp.run(rfi);
-					rfi.close();
-
-					for (long int k=0; k<ncand; k++)
+	                memcpy(&databuf_t.buffer[0]+bcnt1*nchans, buffer_t, sizeof(float)*1*nchans);
+	                bcnt1++;
+					ntot++;
+
+					if (ntot%ndump == 0)
 					{
-                        dedisp.get_subdata(subdata, k);
-                        if (dedisp.counter >= dedisp.offset+dedisp.ndump)
+						preprocess_t.open();
+						preprocess_t.run(databuf_t);
+						databuf_t.close();
+
+						/** the first RFI stage reads the preprocessed chunk, the following ones work in place */
+						DataBuffer<float> *data = &preprocess_t;
+						if (!rfilist.empty())
 						{
-							if (vm.count("dspsr"))
-								folder[k].runDspsr(subdata);
-							else
-								folder[k].runTRLSM(subdata);				
+							rfi_t.open();
+							for (auto irfi = rfilist.begin(); irfi!=rfilist.end(); ++irfi)
+	                        {
+	                            if ((*irfi)[0] == "mask")
+	                            {
+	                                rfi_t.mask(*data, threMask, stoi((*irfi)[1]), stoi((*irfi)[2]));
+	                            }
+	                            else if ((*irfi)[0] == "kadaneF")
+	                            {
+	                                rfi_t.kadaneF(*data, threKadaneF*threKadaneF, widthlimit, stoi((*irfi)[1]), stoi((*irfi)[2]));
+	                            }
+	                            else if ((*irfi)[0] == "kadaneT")
+	                            {
+	                                rfi_t.kadaneT(*data, threKadaneT*threKadaneT, bandlimitKT, stoi((*irfi)[1]), stoi((*irfi)[2]));
+	                            }
+	                            else if ((*irfi)[0] == "sk")
+	                            {
+	                                rfi_t.sk(*data, preprocess_t.chmean, preprocess_t.chstd, threSK, stoi((*irfi)[1]), stoi((*irfi)[2]));
+	                            }
+	                            else if ((*irfi)[0] == "zdot")
+	                            {
+	                                rfi_t.zdot(*data);
+	                            }
+	                            else if ((*irfi)[0] == "zero")
+	                            {
+	                                rfi_t.zero(*data);
+	                            }
+	                            data = &rfi_t;
+	                        }
+							preprocess_t.close();
 						}
+
+						dedisp_t.run(*data);
+						data->close();
+
+						if (dedisp_t.counter >= dedisp_t.offset+dedisp_t.ndump and nfold < cend-cstart)
+						{
+							fold(dedisp_t, folder_t, vm.count("dspsr"));
+							nfold++;
+						}
+
+	                    bcnt1 = 0;
+						databuf_t.open();
 					}
 
-                    bcnt1 = 0;
-					databuf.open();
+					pcur += it_t.npol*it_t.nchan;
 				}
-
-				pcur += it.npol*it.nchan;
 			}
+			psf_t[n].close();
 		}
-		psf[n].close();
+		databuf_t.close();
+
+		/**
+		 * @brief flush the end data, if the range ends within the dm delay of the end
+		 * 
+		 */
+		for (long int l=0; l<nlag and nfold<cend-cstart; l++)
+		{
+			/** dedisp_t.run closes its input */
+			rfi_t.open();
+			dedisp_t.run(rfi_t);
+			fold(dedisp_t, folder_t, vm.count("dspsr"));
+			nfold++;
+		}
+
+		rfi_t.close();
+		dedisp_t.close();
+
+		delete [] buffer_t;
+		delete [] psf_t;
 	}
-	databuf.close();
 
-	/**
-	 * @brief flush the end data
-	 * 
-	 */
-	rfi.open();
-	int nleft = dedisp.offset/ndump;
-	for (long int l=0; l<nleft; l++)
+	for (long int k=0; k<ncand; k++)
 	{
-		dedisp.run(rfi);
-		for (long int k=0; k<ncand; k++)
+		if (spillfd >= 0)
 		{
-			dedisp.get_subdata(subdata, k);
-			if (vm.count("dspsr"))
-				folder[k].runDspsr(subdata);
-			else
-				folder[k].runTRLSM(subdata);				
+			if (!folder[k].map(spillfd, spilloffs[k], nchunk))
+				exit(-1);
+		}
+		else if (nrange > 1)
+			folder[k].reserve(nchunk);
+		for (long int r=0; r<nrange; r++)
+		{
+			folder[k].append(folders[r][k]);
 		}
 	}
+	folders.clear();
 
-	rfi.close();
 	dedisp.close();
 
 	double fmin = 1e6;
@@ -495,7 +630,8 @@ int main(int argc, const char *argv[])
 		gridsearch[k].clfd_q = vm["clfd"].as<double>();
 
 		gridsearch[k].prepare(folder[k]);
-		folder[k].close();
+		if (spillfd < 0)
+			folder[k].close();
 		
 		if (!nosearch)
 		{
@@ -547,6 +683,10 @@ int main(int argc, const char *argv[])
 
 		gridsearch[k].runFFdot();
 		gridsearch[k].runDM();
+
+		/** keep only the profiles of the candidates being searched or written in memory */
+		if (spillfd >= 0)
+			gridsearch[k].unload(folder[k].get_data());
 	}
 
 	/** form obsinfo*/
@@ -621,6 +761,9 @@ int main(int argc, const char *argv[])
 		ss_id << setw(5) << setfill('0') << k+1;
 		string s_id = ss_id.str();
 
+		if (spillfd >= 0)
+			gridsearch[k].load(folder[k].get_data());
+
 		if (!noarch)
 		{
 			ArchiveWriter writer;
@@ -631,6 +774,17 @@ int main(int argc, const char *argv[])
 			writer.ra = s_ra;
 			writer.dec = s_dec;
 			writer.rootname = rootname + "_" + obsinfo["Date"] + "_" + s_ibeam + "_" + s_id;
+			if (!folder[k].t2pred.empty())
+			{
+				if (!folder[k].t2pred.psrname.empty())
+					writer.src_name = folder[k].t2pred.psrname;
+				writer.t2predict = folder[k].t2pred.text;
+				if (vm.count("par"))
+				{
+					PsrparamHDU par(vm["par"].as<vector<string>>()[k]);
+					writer.psrparam = par.text;
+				}
+			}
 
 			writer.prepare(folder[k], gridsearch[k]);
 			writer.run(folder[k], gridsearch[k]);
@@ -675,17 +829,25 @@ int main(int argc, const char *argv[])
 			psrplot.plot(dedisp, folder[k], gridsearch[k], obsinfo, k+1, rootname);
 		}
 #endif
+
+		if (spillfd >= 0)
+		{
+			gridsearch[k].close();
+			folder[k].close();
+		}
 	}
 
+	if (spillfd >= 0)
+		close(spillfd);
+
 	outfile.close();
 
 	if (verbose)
 	{
-		cerr<<"\r\rfinish "<<setprecision(2)<<fixed<<tsamp*count<<" seconds ";
-		cerr<<"("<<100.*count/ntotal<<"%)"<<endl;
+		cerr<<"\r\rfinish "<<setprecision(2)<<fixed<<tsamp*ntotal<<" seconds ";
+		cerr<<"("<<100.<<"%)"<<endl;
 	}
 
-	delete [] buffer;
 	delete [] psf;
 
     return 0;
@@ -704,7 +866,48 @@ void produce(variables_map &vm, Pulsar::DedispersionLite &dedisp, vector<Pulsar:
     dedisp.vdm.push_back(vm["dm"].as<double>());
     dedisp.nsubband = vm["nsubband"].as<int>();
 
-    if (vm.count("candfile"))
+    if (vm.count("pred"))
+    {
+        vector<string> predfiles = vm["pred"].as<vector<string>>();
+        vector<string> parfiles;
+        if (vm.count("par"))
+        {
+            parfiles = vm["par"].as<vector<string>>();
+            if (parfiles.size() != predfiles.size())
+            {
+                cerr<<"Error: the numbers of par and predictor files are different"<<endl;
+                exit(-1);
+            }
+        }
+
+        dedisp.vdm.clear();
+        for (long int k=0; k<(long int)predfiles.size(); k++)
+        {
+            Pulsar::ArchiveLite psr = fdr;
+            if (!psr.t2pred.load(predfiles[k]))
+            {
+                cerr<<"Error: can not load predictor "<<predfiles[k]<<endl;
+                exit(-1);
+            }
+
+            double dm = vm["dm"].as<double>();
+            if (!parfiles.empty())
+            {
+                PsrparamHDU par(parfiles[k]);
+                for (auto line=par.text.begin(); line!=par.text.end(); ++line)
+                {
+                    istringstream ss(*line);
+                    string key;
+                    ss>>key;
+                    if (key == "DM") ss>>dm;
+                }
+            }
+
+            dedisp.vdm.push_back(dm);
+            folder.push_back(psr);
+        }
+    }
+    else if (vm.count("candfile"))
     {
         string filename = vm["candfile"].as<string>();
         string line;
@@ -732,3 +935,38 @@ void produce(variables_map &vm, Pulsar::DedispersionLite &dedisp, vector<Pulsar:
         folder.push_back(fdr);
     }
 }
+
+/**
+ * @brief Fold the current chunk into every candidate, the candidates are independent
+ *        and are distributed over the threads, they read the subband data shared by their dm
+ */
+void fold(const Pulsar::DedispersionLite &dedisp, vector<Pulsar::ArchiveLite> &folder, bool dspsr)
+{
+    long int ncand = folder.size();
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1) if(ncand > 1)
+#endif
+    for (long int k=0; k<ncand; k++)
+    {
+        if (dedisp.direct)
+            folder[k].runTRLSM(dedisp, k);
+        else if (dspsr)
+            folder[k].runDspsr(dedisp.get_subdata(k));
+        else
+            folder[k].runTRLSM(dedisp.get_subdata(k));
+    }
+}
+
+/**
+ * @brief The largest power of two not above the samples per period and nbinmax, at least min(8, nbinmax),
+ *        fast pulsars are not folded into more bins than samples and slow ones not into more than nbinmax
+ */
+int adapt_nbin(double f0, double tsamp, int nbinmax)
+{
+    double nsamp = 1./(abs(f0)*tsamp);
+    int nbin = min(8, nbinmax);
+    while (2*nbin <= nsamp and 2*nbin <= nbinmax)
+        nbin *= 2;
+    return nbin;
+}
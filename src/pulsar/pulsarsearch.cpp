@@ -7,9 +7,12 @@
  */
 
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <vector>
 
 #include "pulsarsearch.h"
+#include "utils.h"
 
 using namespace std;
 
@@ -17,15 +20,20 @@ PulsarSearch::PulsarSearch()
 {
     td = 1;
     fd = 1;
+    eqmode = ChannelStatistics::CHUNK;
+    eqtime = 10.;
     threMask = 7;
     bandlimit = 10;
     bandlimitKT = 10.;
     threKadaneT = 7;
     threKadaneF = 10;
+    threSK = 5;
     widthlimit = 10e-3;
     dms = 0;
     ddm = 1;
     ndm = 1000;
+    precision = RealTime::FP32;
+    baseline = 0.;
     
     ibeam = 1;
     id = 1;
@@ -35,17 +43,20 @@ PulsarSearch::~PulsarSearch(){}
 
 void PulsarSearch::prepare(DataBuffer<float> &databuffer)
 {
-    downsample.td = td;
-    downsample.fd = fd;
-    downsample.prepare(databuffer);
+    preprocess.td = td;
+    preprocess.fd = fd;
+    preprocess.stats.mode = eqmode;
+    preprocess.stats.timescale = eqtime;
+    preprocess.prepare(databuffer);
+    preprocess.zap(zaplist);
 
-    equalize.prepare(downsample);
-
-    rfi.prepare(equalize);
+    rfi.prepare(preprocess);
 
     dedisp.dms = dms;
     dedisp.ddm = ddm;
     dedisp.ndm = ndm;
+    dedisp.precision = precision;
+    dedisp.baseline = baseline;
     dedisp.ndump = rfi.nsamples;
     dedisp.rootname = rootname;
     dedisp.prepare(rfi);
@@ -54,41 +65,79 @@ void PulsarSearch::prepare(DataBuffer<float> &databuffer)
 
 void PulsarSearch::run(DataBuffer<float> &databuffer)
 {
-    downsample.run(databuffer);
-    
-    equalize.run(downsample);
-    
-    rfi.zap(equalize, zaplist);
-	
+    preprocess.run(databuffer);
+
+    /** the first RFI stage reads the preprocessed chunk, the following ones work in place */
+    DataBuffer<float> *data = &preprocess;
     for (auto irfi = rfilist.begin(); irfi!=rfilist.end(); ++irfi)
 	{
         if ((*irfi)[0] == "mask")
         {
-            rfi.mask(rfi, threMask, stoi((*irfi)[1]), stoi((*irfi)[2]));
+            rfi.mask(*data, threMask, stoi((*irfi)[1]), stoi((*irfi)[2]));
         }
         else if ((*irfi)[0] == "kadaneF")
         {
-            rfi.kadaneF(rfi, threKadaneF*threKadaneF, widthlimit, stoi((*irfi)[1]), stoi((*irfi)[2]));
+            rfi.kadaneF(*data, threKadaneF*threKadaneF, widthlimit, stoi((*irfi)[1]), stoi((*irfi)[2]));
         }
         else if ((*irfi)[0] == "kadaneT")
         {
-            rfi.kadaneT(rfi, threKadaneT*threKadaneT, bandlimitKT, stoi((*irfi)[1]), stoi((*irfi)[2]));
+            rfi.kadaneT(*data, threKadaneT*threKadaneT, bandlimitKT, stoi((*irfi)[1]), stoi((*irfi)[2]));
+        }
+        else if ((*irfi)[0] == "sk")
+        {
+            rfi.sk(*data, preprocess.chmean, preprocess.chstd, threSK, stoi((*irfi)[1]), stoi((*irfi)[2]));
         }
 		else if ((*irfi)[0] == "zdot")
         {
-			rfi.zdot(rfi);
+			rfi.zdot(*data);
         }
 		else if ((*irfi)[0] == "zero")
         {
-			rfi.zero(rfi);
+			rfi.zero(*data);
         }
+        data = &rfi;
 	}
 
-    
-    dedisp.run(rfi, rfi.nsamples);
+    dedisp.run(*data, data->nsamples);
     dedisp.rundump();
 }
 
+/**
+ * @brief Get the memory (in bytes) that prepare will allocate for chunks like databuffer
+ * 
+ * @param databuffer 
+ * @return size_t 
+ */
+size_t PulsarSearch::get_memory(const DataBuffer<float> &databuffer) const
+{
+    DataBuffer<float> ds;
+    ds.nsamples = databuffer.nsamples/td;
+    ds.nchans = databuffer.nchans/fd;
+    ds.tsamp = databuffer.tsamp*td;
+    ds.frequencies.resize(ds.nchans, 0.);
+    for (long int j=0; j<ds.nchans; j++)
+    {
+        for (long int k=0; k<fd; k++)
+        {
+            ds.frequencies[j] += databuffer.frequencies[j*fd+k];
+        }
+        ds.frequencies[j] /= fd;
+    }
+
+    RealTime::SubbandDedispersion dd;
+    dd.dms = dms;
+    dd.ddm = ddm;
+    dd.ndm = ndm;
+    dd.precision = precision;
+    dd.baseline = baseline;
+
+    /** preprocess and rfi buffers */
+    size_t mem = 2*sizeof(float)*ds.nsamples*ds.nchans;
+    mem += dd.get_memory(ds);
+
+    return mem;
+}
+
 void plan(variables_map &vm, vector<PulsarSearch> &search)
 {
     PulsarSearch sp;
@@ -96,6 +145,9 @@ void plan(variables_map &vm, vector<PulsarSearch> &search)
     sp.td = vm["td"].as<int>();
 	sp.fd = vm["fd"].as<int>();
 
+    ChannelStatistics::parse_mode(vm["equalize"].as<string>(), sp.eqmode);
+    sp.eqtime = vm["eqtime"].as<double>();
+
 	//fast
 	// sp.zaplist.push_back(pair<double, double>(1170, 1186));
 	// sp.zaplist.push_back(pair<double, double>(1197, 1215));
@@ -108,7 +160,7 @@ void plan(variables_map &vm, vector<PulsarSearch> &search)
         rfi_opts = vm["rfi"].as<vector<string>>();
         for (auto opt=rfi_opts.begin(); opt!=rfi_opts.end(); ++opt)
         {
-            if (*opt=="mask" or *opt=="kadaneF" or *opt=="kadaneT")
+            if (*opt=="mask" or *opt=="kadaneF" or *opt=="kadaneT" or *opt=="sk")
             {
                 vector<string> temp{*opt, *(opt+1), *(opt+2)};       
                 sp.rfilist.push_back(temp);
@@ -132,12 +184,28 @@ void plan(variables_map &vm, vector<PulsarSearch> &search)
     sp.bandlimitKT = vm["bandlimitKT"].as<double>();
     sp.threKadaneF = vm["threKadaneF"].as<float>();
     sp.threKadaneT = vm["threKadaneT"].as<float>();
+    sp.threSK = vm["threSK"].as<float>();
     sp.widthlimit = vm["widthlimit"].as<double>();
 
     sp.dms = vm["dms"].as<double>();
 	sp.ddm = vm["ddm"].as<double>();
 	sp.ndm = vm["ndm"].as<int>();
 
+    sp.baseline = vm["baseline"].as<double>();
+
+    string s_precision = vm["precision"].as<string>();
+    if (s_precision == "fp16")
+        sp.precision = RealTime::FP16;
+    else if (s_precision == "bf16")
+        sp.precision = RealTime::BF16;
+    else if (s_precision == "float")
+        sp.precision = RealTime::FP32;
+    else
+    {
+        cerr<<"Error: unknown precision "<<s_precision<<endl;
+        exit(-1);
+    }
+
     if (vm.count("ddplan"))
     {
         string filename = vm["ddplan"].as<string>();
@@ -158,7 +226,7 @@ void plan(variables_map &vm, vector<PulsarSearch> &search)
             sp.rfilist.clear();
             for (auto opt=parameters.begin()+9; opt!=parameters.end(); ++opt)
             {
-                if (*opt=="mask" or *opt=="kadaneF" or *opt=="kadaneT")
+                if (*opt=="mask" or *opt=="kadaneF" or *opt=="kadaneT" or *opt=="sk")
                 {
                     vector<string> temp{*opt, *(opt+1), *(opt+2)};       
                     sp.rfilist.push_back(temp);
@@ -187,3 +255,126 @@ void plan(variables_map &vm, vector<PulsarSearch> &search)
         search.push_back(sp);
     }
 }
+
+/**
+ * @brief split the DM range of sp until every part fits in maxmemory
+ * 
+ * @return false if a part with only one subband DM group still does not fit
+ */
+static bool split_dmrange(const PulsarSearch &sp, const DataBuffer<float> &databuffer, double maxmemory, vector<PulsarSearch> &entries)
+{
+    if (sp.get_memory(databuffer) <= maxmemory)
+    {
+        entries.push_back(sp);
+        return true;
+    }
+
+    long int nsubband = round(sqrt(databuffer.nchans/sp.fd));
+    if (sp.ndm <= nsubband)
+        return false;
+
+    long int ndm1 = ceil(0.5*sp.ndm/nsubband)*nsubband;
+
+    PulsarSearch sp1 = sp;
+    sp1.ndm = ndm1;
+
+    PulsarSearch sp2 = sp;
+    sp2.dms = sp.dms+ndm1*sp.ddm;
+    sp2.ndm = sp.ndm-ndm1;
+
+    return split_dmrange(sp1, databuffer, maxmemory, entries) and split_dmrange(sp2, databuffer, maxmemory, entries);
+}
+
+/**
+ * @brief Report the memory footprint of every ddplan entry and group the entries into sequential passes,
+ *        each pass using no more than maxmemory. Entries that do not fit alone are split in DM,
+ *        and ndump is shrunk if one subband DM group still does not fit.
+ * 
+ * @param search: ddplan entries
+ * @param passes: entries processed in each pass over the data
+ * @param databuffer: input chunk, resized if ndump is shrunk
+ * @param maxmemory: memory cap in bytes, no cap if maxmemory<=0
+ * @return ndump, -1 if the plan can not fit in maxmemory
+ */
+long int plan_memory(vector<PulsarSearch> &search, vector<vector<PulsarSearch>> &passes, DataBuffer<float> &databuffer, double maxmemory, bool verbose)
+{
+    vector<int> tds;
+    for (auto sp=search.begin(); sp!=search.end(); ++sp)
+    {
+        tds.push_back((*sp).td);
+    }
+    long int td_lcm = findlcm(&tds[0], tds.size());
+
+    long int ndump = databuffer.nsamples;
+
+    vector<PulsarSearch> entries;
+    size_t mem_databuffer = 0;
+    while (true)
+    {
+        DataBuffer<float> chunk;
+        chunk.nsamples = ndump;
+        chunk.nchans = databuffer.nchans;
+        chunk.tsamp = databuffer.tsamp;
+        chunk.frequencies = databuffer.frequencies;
+
+        mem_databuffer = sizeof(float)*ndump*databuffer.nchans;
+
+        entries.clear();
+        bool fit = true;
+        for (auto sp=search.begin(); sp!=search.end(); ++sp)
+        {
+            if (maxmemory <= 0)
+            {
+                entries.push_back(*sp);
+                continue;
+            }
+
+            if (!split_dmrange(*sp, chunk, maxmemory-mem_databuffer, entries))
+            {
+                fit = false;
+                break;
+            }
+        }
+
+        if (fit) break;
+
+        ndump = ndump/2/td_lcm*td_lcm;
+        if (ndump < td_lcm)
+        {
+            cerr<<"Error: dedispersion can not fit in "<<maxmemory/(1024.*1024.*1024.)<<" GB"<<endl;
+            return -1;
+        }
+    }
+
+    if (ndump != databuffer.nsamples)
+    {
+        cerr<<"Warning: ndump is shrunk to "<<ndump<<" to fit in "<<maxmemory/(1024.*1024.*1024.)<<" GB"<<endl;
+        databuffer.resize(ndump, databuffer.nchans);
+    }
+
+    passes.clear();
+    size_t mem_pass = 0;
+    for (auto sp=entries.begin(); sp!=entries.end(); ++sp)
+    {
+        size_t mem = (*sp).get_memory(databuffer);
+        if (passes.empty() or (maxmemory > 0 and mem_pass+mem > maxmemory))
+        {
+            passes.push_back(vector<PulsarSearch>());
+            mem_pass = mem_databuffer;
+        }
+        passes.back().push_back(*sp);
+        mem_pass += mem;
+
+        if (verbose)
+        {
+            cerr<<"pass "<<passes.size()<<" ddplan "<<(*sp).id;
+            cerr<<": td="<<(*sp).td<<" fd="<<(*sp).fd;
+            cerr<<" dms="<<(*sp).dms<<" ddm="<<(*sp).ddm<<" ndm="<<(*sp).ndm;
+            stringstream ss_mem;
+            ss_mem<<fixed<<setprecision(3)<<mem/(1024.*1024.*1024.);
+            cerr<<" memory="<<ss_mem.str()<<" GB"<<endl;
+        }
+    }
+
+    return ndump;
+}
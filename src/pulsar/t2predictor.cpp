@@ -0,0 +1,217 @@
+/**
+ * @author Yunpeng Men
+ * @email ypmen@pku.edu.cn
+ * @create date 2020-11-14 15:32:08
+ * @modify date 2020-11-14 15:32:08
+ * @desc tempo2 predictor (ChebyModelSet), pulse phase and frequency of a known pulsar from its ephemeris
+ */
+
+#include <math.h>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "t2predictor.h"
+
+using namespace Pulsar;
+
+T2Predictor::T2Predictor(){}
+
+T2Predictor::~T2Predictor(){}
+
+bool T2Predictor::load(const string &fname)
+{
+    ifstream infile(fname);
+    if (!infile.is_open())
+    {
+        cerr<<"Error: can not open file '"<<fname<<"'"<<endl;
+        return false;
+    }
+
+    vector<string> lines;
+    string line;
+    while (getline(infile, line))
+    {
+        lines.push_back(line);
+    }
+    infile.close();
+
+    return load(lines);
+}
+
+/**
+ * @brief Parse the segments between "ChebyModel BEGIN" and "ChebyModel END"
+ */
+bool T2Predictor::load(const vector<string> &lines)
+{
+    text = lines;
+    models.clear();
+
+    ChebyModel cm;
+    bool inmodel = false;
+    for (auto l=lines.begin(); l!=lines.end(); ++l)
+    {
+        istringstream ss(*l);
+        string key;
+        ss>>key;
+
+        if (key == "ChebyModel")
+        {
+            string tag;
+            ss>>tag;
+            if (tag == "BEGIN")
+            {
+                cm = ChebyModel();
+                cm.nx = 0;
+                cm.ny = 0;
+                cm.dispersion_constant = 0.;
+                inmodel = true;
+            }
+            else if (tag == "END" and inmodel)
+            {
+                if (cm.nx <= 0 or cm.ny <= 0 or (long int)cm.coeff.size() != cm.nx*cm.ny)
+                {
+                    cerr<<"Error: wrong number of coefficients in predictor"<<endl;
+                    models.clear();
+                    return false;
+                }
+
+                /** derivative of the series in x, the same recurrence in each column iy */
+                cm.dcoeff.assign(cm.nx*cm.ny, 0.);
+                for (long int iy=0; iy<cm.ny; iy++)
+                {
+                    if (cm.nx < 2) continue;
+                    cm.dcoeff[(cm.nx-2)*cm.ny+iy] = 2*(cm.nx-1)*cm.coeff[(cm.nx-1)*cm.ny+iy];
+                    for (long int ix=cm.nx-2; ix>0; ix--)
+                    {
+                        cm.dcoeff[(ix-1)*cm.ny+iy] = cm.dcoeff[(ix+1)*cm.ny+iy] + 2*ix*cm.coeff[ix*cm.ny+iy];
+                    }
+                }
+
+                models.push_back(cm);
+                inmodel = false;
+            }
+        }
+        else if (!inmodel)
+        {
+            continue;
+        }
+        else if (key == "PSRNAME")
+        {
+            ss>>psrname;
+        }
+        else if (key == "TIME_RANGE")
+        {
+            ss>>cm.mjd_start>>cm.mjd_end;
+        }
+        else if (key == "FREQ_RANGE")
+        {
+            ss>>cm.freq_start>>cm.freq_end;
+        }
+        else if (key == "DISPERSION_CONSTANT")
+        {
+            ss>>cm.dispersion_constant;
+        }
+        else if (key == "NCOEFF_TIME")
+        {
+            ss>>cm.nx;
+        }
+        else if (key == "NCOEFF_FREQ")
+        {
+            ss>>cm.ny;
+        }
+        else if (key == "COEFFS")
+        {
+            long double c;
+            while (ss>>c) cm.coeff.push_back(c);
+        }
+    }
+
+    if (models.empty())
+    {
+        cerr<<"Error: no ChebyModel in predictor"<<endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief The segment whose midpoint is closest to mjd
+ */
+const ChebyModel & T2Predictor::get_model(long double mjd) const
+{
+    long int best = 0;
+    long double dbest = fabsl(mjd-0.5*(models[0].mjd_start+models[0].mjd_end));
+    for (long int k=1; k<(long int)models.size(); k++)
+    {
+        long double d = fabsl(mjd-0.5*(models[k].mjd_start+models[k].mjd_end));
+        if (d < dbest)
+        {
+            dbest = d;
+            best = k;
+        }
+    }
+    return models[best];
+}
+
+/**
+ * @brief Clenshaw recurrence in y for each ix, then in x
+ */
+long double T2Predictor::evaluate(const vector<long double> &c, int nx, int ny, long double x, long double y)
+{
+    long double sx1 = 0., sx2 = 0.;
+    for (long int ix=nx-1; ix>=0; ix--)
+    {
+        long double sy1 = 0., sy2 = 0.;
+        for (long int iy=ny-1; iy>0; iy--)
+        {
+            long double tmp = sy1;
+            sy1 = 2.*y*sy1 - sy2 + c[ix*ny+iy];
+            sy2 = tmp;
+        }
+        long double cx = y*sy1 - sy2 + 0.5*c[ix*ny];
+
+        if (ix > 0)
+        {
+            long double tmp = sx1;
+            sx1 = 2.*x*sx1 - sx2 + cx;
+            sx2 = tmp;
+        }
+        else
+        {
+            return x*sx1 - sx2 + 0.5*cx;
+        }
+    }
+    return 0.;
+}
+
+/**
+ * @brief Pulse phase in turns at mjd, observed at freq (MHz)
+ */
+long double T2Predictor::get_phase(MJD mjd, long double freq) const
+{
+    const ChebyModel &cm = get_model(mjd.to_day());
+
+    /** the day and the seconds are subtracted separately, mjd.to_day() rounds to about 1 ns */
+    long double day = (mjd.stt_imjd-cm.mjd_start)+((long double)mjd.stt_smjd+mjd.stt_offs)/86400.;
+    long double x = 2.*day/(cm.mjd_end-cm.mjd_start)-1.;
+    long double y = 2.*(freq-cm.freq_start)/(cm.freq_end-cm.freq_start)-1.;
+
+    return evaluate(cm.coeff, cm.nx, cm.ny, x, y) + cm.dispersion_constant/(freq*freq);
+}
+
+/**
+ * @brief Pulse frequency in Hz at mjd, observed at freq (MHz)
+ */
+long double T2Predictor::get_ffold(MJD mjd, long double freq) const
+{
+    const ChebyModel &cm = get_model(mjd.to_day());
+
+    /** the day and the seconds are subtracted separately, mjd.to_day() rounds to about 1 ns */
+    long double day = (mjd.stt_imjd-cm.mjd_start)+((long double)mjd.stt_smjd+mjd.stt_offs)/86400.;
+    long double x = 2.*day/(cm.mjd_end-cm.mjd_start)-1.;
+    long double y = 2.*(freq-cm.freq_start)/(cm.freq_end-cm.freq_start)-1.;
+
+    return evaluate(cm.dcoeff, cm.nx, cm.ny, x, y)*2./(cm.mjd_end-cm.mjd_start)/86400.;
+}
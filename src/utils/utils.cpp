@@ -8,8 +8,12 @@
 #include <limits>
 #include <assert.h>
 #include <set>
+#include <stdint.h>
+#ifdef __SSE__
+#include <immintrin.h>
+#endif
 #include "utils.h"
-#include "AVL.h"
+#include "runmedian.h"
 #include "dedisperse.h"
 
 long double to_longdouble(double value1, double value2)
@@ -74,218 +78,229 @@ fftw_plan plan_transpose(int rows, int cols, double *in, double *out)
                               in, out, /*kind=*/NULL, flags);
 }
 
-template <typename T>
-void transpose(T *out, T *in, int m, int n)
+#define TRANSPOSE_TILE 64
+/** matrices smaller than this (elements) are transposed by the calling thread */
+#define TRANSPOSE_PARALLEL 65536
+#define CACHELINE 64
+
+#ifdef __SSE__
+/**
+ * @brief Transpose the 4x4 block at in (row stride ldi) to out (row stride ldo) in registers
+ */
+static inline void transpose4x4_ps(float *out, long int ldo, const float *in, long int ldi)
 {
-    const int tilex = 16;
-    const int tiley = 64;
+    __m128 r0 = _mm_loadu_ps(in+0*ldi);
+    __m128 r1 = _mm_loadu_ps(in+1*ldi);
+    __m128 r2 = _mm_loadu_ps(in+2*ldi);
+    __m128 r3 = _mm_loadu_ps(in+3*ldi);
 
-    assert(n % tilex == 0);
-    assert(m % tiley == 0);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
 
-    int blockx = n / tilex;
-    int blocky = m / tiley;
+    _mm_storeu_ps(out+0*ldo, r0);
+    _mm_storeu_ps(out+1*ldo, r1);
+    _mm_storeu_ps(out+2*ldo, r2);
+    _mm_storeu_ps(out+3*ldo, r3);
+}
+#endif
 
-    T *temp = new T[num_threads * tiley * tilex];
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads)
+#ifdef __AVX2__
+/**
+ * @brief Transpose the 8x8 block at in (row stride ldi) to out (row stride ldo) in registers
+ */
+static inline void transpose8x8_ps(float *out, long int ldo, const float *in, long int ldi)
+{
+    __m256 r0 = _mm256_loadu_ps(in+0*ldi);
+    __m256 r1 = _mm256_loadu_ps(in+1*ldi);
+    __m256 r2 = _mm256_loadu_ps(in+2*ldi);
+    __m256 r3 = _mm256_loadu_ps(in+3*ldi);
+    __m256 r4 = _mm256_loadu_ps(in+4*ldi);
+    __m256 r5 = _mm256_loadu_ps(in+5*ldi);
+    __m256 r6 = _mm256_loadu_ps(in+6*ldi);
+    __m256 r7 = _mm256_loadu_ps(in+7*ldi);
+
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+    __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+    __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+    __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+    __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+    __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+    __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+    __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    _mm256_storeu_ps(out+0*ldo, _mm256_permute2f128_ps(s0, s4, 0x20));
+    _mm256_storeu_ps(out+1*ldo, _mm256_permute2f128_ps(s1, s5, 0x20));
+    _mm256_storeu_ps(out+2*ldo, _mm256_permute2f128_ps(s2, s6, 0x20));
+    _mm256_storeu_ps(out+3*ldo, _mm256_permute2f128_ps(s3, s7, 0x20));
+    _mm256_storeu_ps(out+4*ldo, _mm256_permute2f128_ps(s0, s4, 0x31));
+    _mm256_storeu_ps(out+5*ldo, _mm256_permute2f128_ps(s1, s5, 0x31));
+    _mm256_storeu_ps(out+6*ldo, _mm256_permute2f128_ps(s2, s6, 0x31));
+    _mm256_storeu_ps(out+7*ldo, _mm256_permute2f128_ps(s3, s7, 0x31));
+}
 #endif
-    for (long int s = 0; s < blocky*blockx; s++)
+
+#ifdef __AVX512F__
+/**
+ * @brief Transpose the 16x16 block at in (row stride ldi) to out (row stride ldo) in registers
+ */
+static inline void transpose16x16_ps(float *out, long int ldo, const float *in, long int ldi)
+{
+    __m512 r[16], t[16];
+
+    for (int i=0; i<16; i++)
+        r[i] = _mm512_loadu_ps(in+i*ldi);
+
+    /** interleave 32-bit pairs of row pairs */
+    for (int k=0; k<8; k++)
     {
-        T *ptemp = temp;
-#ifdef _OPENMP
-        ptemp = temp + omp_get_thread_num()*tiley*tilex;
-#endif
-        long int l = s/blockx;
-        long int k = s%blockx;
+        t[2*k] = _mm512_unpacklo_ps(r[2*k], r[2*k+1]);
+        t[2*k+1] = _mm512_unpackhi_ps(r[2*k], r[2*k+1]);
+    }
 
-        for (long int i = 0; i < tiley; i++)
-        {
-            for (long int j = 0; j < tilex; j++)
-            {
-                ptemp[j * tiley + i] = in[l * tiley * n + i * n + k * tilex + j];
-            }
-        }
-        for (long int i = 0; i < tilex; i++)
-        {
-            for (long int j = 0; j < tiley; j++)
-            {
-                out[k * tilex * m + i * m + l * tiley + j] = ptemp[i * tiley + j];
-            }
-        }
+    /** 4x4 blocks inside each 128-bit lane, r[4k+c] holds column 4j+c of rows 4k..4k+3 in lane j */
+    for (int k=0; k<4; k++)
+    {
+        __m512d a = _mm512_castps_pd(t[4*k]);
+        __m512d b = _mm512_castps_pd(t[4*k+1]);
+        __m512d c = _mm512_castps_pd(t[4*k+2]);
+        __m512d d = _mm512_castps_pd(t[4*k+3]);
+        r[4*k] = _mm512_castpd_ps(_mm512_unpacklo_pd(a, c));
+        r[4*k+1] = _mm512_castpd_ps(_mm512_unpackhi_pd(a, c));
+        r[4*k+2] = _mm512_castpd_ps(_mm512_unpacklo_pd(b, d));
+        r[4*k+3] = _mm512_castpd_ps(_mm512_unpackhi_pd(b, d));
     }
 
-    delete[] temp;
+    /** gather lane j of r[c], r[4+c], r[8+c], r[12+c] into output row 4j+c */
+    for (int c=0; c<4; c++)
+    {
+        __m512 u0 = _mm512_shuffle_f32x4(r[c], r[4+c], 0x88);
+        __m512 u1 = _mm512_shuffle_f32x4(r[c], r[4+c], 0xdd);
+        __m512 v0 = _mm512_shuffle_f32x4(r[8+c], r[12+c], 0x88);
+        __m512 v1 = _mm512_shuffle_f32x4(r[8+c], r[12+c], 0xdd);
+        _mm512_storeu_ps(out+(0+c)*ldo, _mm512_shuffle_f32x4(u0, v0, 0x88));
+        _mm512_storeu_ps(out+(4+c)*ldo, _mm512_shuffle_f32x4(u1, v1, 0x88));
+        _mm512_storeu_ps(out+(8+c)*ldo, _mm512_shuffle_f32x4(u0, v0, 0xdd));
+        _mm512_storeu_ps(out+(12+c)*ldo, _mm512_shuffle_f32x4(u1, v1, 0xdd));
+    }
 }
+#endif
 
+/**
+ * @brief Transpose rows [i0, i1) and columns [j0, j1) of in (m, n) into out (n, m)
+ */
 template <typename T>
-void transpose_pad(T *out, T *in, int m, int n)
+static inline void transpose_block(T *out, const T *in, long int m, long int n, long int i0, long int i1, long int j0, long int j1)
 {
-    const int tilex = 16;
-    const int tiley = 64;
-
-    int npad = ceil(n*1./tilex)*tilex;
-    int mpad = ceil(m*1./tiley)*tiley;
-
-    int blockx = npad / tilex;
-    int blocky = mpad / tiley;
-
-    T *temp = new T[num_threads * tiley * tilex];
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads)
-#endif
-    for (long int s = 0; s < blocky*blockx; s++)
+    for (long int i=i0; i<i1; i++)
     {
-        T *ptemp = temp;
-#ifdef _OPENMP
-        ptemp = temp + omp_get_thread_num()*tiley*tilex;
-#endif
-        long int l = s/blockx;
-        long int k = s%blockx;
-        
-        if ((l+1)*tiley <= m and (k+1)*tilex <= n)
+        for (long int j=j0; j<j1; j++)
         {
-            for (long int i = 0; i < tiley; i++)
-            {
-                for (long int j = 0; j < tilex; j++)
-                {
-                    ptemp[j * tiley + i] = in[(l * tiley + i) * n + k * tilex + j];
-                }
-            }
-            for (long int i = 0; i < tilex; i++)
-            {
-                for (long int j = 0; j < tiley; j++)
-                {
-                    out[(k * tilex + i) * m + l * tiley + j] = ptemp[i * tiley + j];
-                }
-            }
-        }
-        else if ((l+1)*tiley > m and (k+1)*tilex <= n)
-        {
-            for (long int i = 0; i < m-l*tiley; i++)
-            {
-                for (long int j = 0; j < tilex; j++)
-                {
-                    ptemp[j * tiley + i] = in[(l * tiley + i) * n + k * tilex + j];
-                }
-            }
-            for (long int i = 0; i < tilex; i++)
-            {
-                for (long int j = 0; j < m-l*tiley; j++)
-                {
-                    out[(k * tilex + i) * m + l * tiley + j] = ptemp[i * tiley + j];
-                }
-            }
+            out[j*m+i] = in[i*n+j];
         }
-        else if ((l+1)*tiley <= m and (k+1)*tilex > n)
+    }
+}
+
+static inline void transpose_block(float *out, const float *in, long int m, long int n, long int i0, long int i1, long int j0, long int j1)
+{
+    long int i = i0;
+#ifdef __AVX512F__
+    for (; i+16<=i1; i+=16)
+    {
+        long int j = j0;
+        for (; j+16<=j1; j+=16)
+            transpose16x16_ps(out+j*m+i, m, in+i*n+j, n);
+        for (; j+8<=j1; j+=8)
         {
-            for (long int i = 0; i < tiley; i++)
-            {
-                for (long int j = 0; j < n-k*tilex; j++)
-                {
-                    ptemp[j * tiley + i] = in[(l * tiley + i) * n + k * tilex + j];
-                }
-            }
-            for (long int i = 0; i < n-k*tilex; i++)
-            {
-                for (long int j = 0; j < tiley; j++)
-                {
-                    out[(k * tilex + i) * m + l * tiley + j] = ptemp[i * tiley + j];
-                }
-            }
-        }
-        else
-        {
-            for (long int i = 0; i < m-l*tiley; i++)
-            {
-                for (long int j = 0; j < n-k*tilex; j++)
-                {
-                    ptemp[j * tiley + i] = in[(l * tiley + i) * n + k * tilex + j];
-                }
-            }
-            for (long int i = 0; i < n-k*tilex; i++)
-            {
-                for (long int j = 0; j < m-l*tiley; j++)
-                {
-                    out[(k * tilex + i) * m + l * tiley + j] = ptemp[i * tiley + j];
-                }
-            }
+            transpose8x8_ps(out+j*m+i, m, in+i*n+j, n);
+            transpose8x8_ps(out+j*m+i+8, m, in+(i+8)*n+j, n);
         }
+        transpose_block<float>(out, in, m, n, i, i+16, j, j1);
     }
-
-    delete[] temp;
+#endif
+#ifdef __AVX2__
+    for (; i+8<=i1; i+=8)
+    {
+        long int j = j0;
+        for (; j+8<=j1; j+=8)
+            transpose8x8_ps(out+j*m+i, m, in+i*n+j, n);
+        transpose_block<float>(out, in, m, n, i, i+8, j, j1);
+    }
+#endif
+#ifdef __SSE__
+    for (; i+4<=i1; i+=4)
+    {
+        long int j = j0;
+        for (; j+4<=j1; j+=4)
+            transpose4x4_ps(out+j*m+i, m, in+i*n+j, n);
+        transpose_block<float>(out, in, m, n, i, i+4, j, j1);
+    }
+#endif
+    transpose_block<float>(out, in, m, n, i, i1, j0, j1);
 }
 
+/**
+ * @brief Transpose in (m, n) to out (n, m) in tiles of tiley x tilex that stay in L1,
+ *        the tiles are spread over the threads for large matrices, no buffer is allocated
+ */
 template <typename T>
-void transpose_pad(T *out, T *in, int m, int n, int tiley, int tilex)
+static void transpose_tiled(T *out, const T *in, long int m, long int n, long int tiley, long int tilex)
 {
-    int npad = ceil(n*1./tilex)*tilex;
-    int mpad = ceil(m*1./tiley)*tiley;
+    /** shift the row tiles so that the output rows of a tile start on a cache line,
+     *  stores split over two lines otherwise, tile 0 takes the unaligned head */
+    long int shift = (CACHELINE-(uintptr_t)out%CACHELINE)%CACHELINE;
+    shift = shift%sizeof(T) == 0 ? min((long int)(shift/sizeof(T)), m) : 0;
 
-    int blockx = npad / tilex;
-    int blocky = mpad / tiley;
+    long int blockx = (n+tilex-1)/tilex;
+    long int blocky = (m-shift+tiley-1)/tiley+1;
 
-    T *temp = new T[num_threads * tiley * tilex];
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads)
+#pragma omp parallel for num_threads(num_threads) if(m*n >= TRANSPOSE_PARALLEL)
 #endif
     for (long int s = 0; s < blocky*blockx; s++)
     {
-        T *ptemp = temp;
-#ifdef _OPENMP
-        ptemp = temp + omp_get_thread_num()*tiley*tilex;
-#endif
         long int l = s/blockx;
         long int k = s%blockx;
-        
-        for (long int i = 0; i < tiley; i++)
-        {
-            for (long int j = 0; j < tilex; j++)
-            {
-                if (l * tiley + i < m and k * tilex + j < n)
-                    ptemp[j * tiley + i] = in[(l * tiley + i) * n + k * tilex + j];
-            }
-        }
-        for (long int i = 0; i < tilex; i++)
-        {
-            for (long int j = 0; j < tiley; j++)
-            {
-                if (k * tilex + i < n and l * tiley + j < m)
-                    out[(k * tilex + i) * m + l * tiley + j] = ptemp[i * tiley + j];
-            }
-        }
-    }
 
-    delete[] temp;    
+        long int i0 = max(0L, shift+(l-1)*tiley);
+        long int i1 = min(shift+l*tiley, m);
+
+        transpose_block(out, in, m, n, i0, i1, k*tilex, min((k+1)*tilex, n));
+    }
 }
 
-void runMedian(float *data, float *datMedian, long int size, int w)
+template <typename T>
+void transpose(T *out, T *in, int m, int n)
 {
-    AVLTree<float> treeMedian;
-
-    w = w > size ? size : w;
-    long int k = 0;
-
-    int a = -floor(w * 0.5);
-    int b = ceil(w * 0.5);
+    transpose_tiled(out, in, m, n, TRANSPOSE_TILE, TRANSPOSE_TILE);
+}
 
-    for (long int i = 0; i < b; i++)
-    {
-        treeMedian.insertValue(data[i]);
-    }
-    datMedian[k++] = treeMedian.getMedian();
+template <typename T>
+void transpose_pad(T *out, T *in, int m, int n)
+{
+    transpose_tiled(out, in, m, n, TRANSPOSE_TILE, TRANSPOSE_TILE);
+}
 
-    for (long int i = 1; i < size; i++)
-    {
-        a++;
-        b++;
-        if (a > 0)
-            treeMedian.removeValue(data[a - 1]);
-        if (b <= size)
-            treeMedian.insertValue(data[b - 1]);
+template <typename T>
+void transpose_pad(T *out, T *in, int m, int n, int tiley, int tilex)
+{
+    transpose_tiled(out, in, m, n, tiley, tilex);
+}
 
-        datMedian[k++] = treeMedian.getMedian();
-    }
+/**
+ * @brief Running median with the window [i-w/2, i+(w+1)/2), truncated at both ends
+ */
+void runMedian(float *data, float *datMedian, long int size, int w)
+{
+    MedianHeap<float> heap(w > size ? size : w);
+    heap.run(data, datMedian, size, w);
 }
 
 template <typename T>
@@ -468,88 +483,93 @@ void runMedian2(T *data, T *datMedian, long int size, int w)
 template <typename T>
 void runMedian3(T *data, T *datMedian, long int size, int w)
 {
-    multiset<T, greater<T>> treeMedian;
+    MedianHeap<T> heap(w > size ? size : w);
+    heap.run(data, datMedian, size, w);
+}
 
+/**
+ * @brief Running median of nseries series of length size (series-major), one heap per thread.
+ *        With ds > 1 the median is approximate: the running median with window w/ds
+ *        of the medians of blocks of ds samples, linearly interpolated back to every sample
+ *
+ * @param data (nseries, size)
+ * @param datMedian (nseries, size)
+ * @param nseries
+ * @param size
+ * @param w window width in samples
+ * @param ds decimation
+ */
+void runMedianBatch(const float *data, float *datMedian, long int nseries, long int size, int w, int ds)
+{
+    ds = ds < 1 ? 1 : ds;
+    ds = ds > size ? size : ds;
     w = w > size ? size : w;
-    long int k = 0;
 
-    int a = -floor(w * 0.5);
-    int b = ceil(w * 0.5);
+    long int nblk = (size+ds-1)/ds;
+    int wds = ds > 1 ? max(1, (int)round(1.*w/ds)) : w;
+    wds = wds > nblk ? nblk : wds;
 
-    for (long int i = 0; i < b; i++)
-    {
-        treeMedian.insert(data[i]);
-    }
+#ifdef _OPENMP
+    int nt = num_threads;
+#else
+    int nt = 1;
+#endif
+
+    vector<MedianHeap<float>> heap_t(nt, MedianHeap<float>(wds));
+    vector<float> blk_t(ds > 1 ? nt*(ds+2*nblk) : 0);
 
-    if (treeMedian.size()%2 == 1)
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (long int k=0; k<nseries; k++)
     {
-        int tmp = 0;
-        for (auto it=treeMedian.begin(); it!=treeMedian.end(); ++it)
+#ifdef _OPENMP
+        int t = omp_get_thread_num();
+#else
+        int t = 0;
+#endif
+        const float *x = data+k*size;
+        float *y = datMedian+k*size;
+
+        if (ds == 1)
         {
-            if (tmp++ == treeMedian.size()/2)
-            {
-                datMedian[k++] = *it;
-            }
+            heap_t[t].run(x, y, size, w);
+            continue;
         }
-    }
-    else
-    {
-        int tmp = 0;
-        for (auto it=treeMedian.begin(); it!=treeMedian.end(); ++it)
-        {
-            if (tmp == treeMedian.size()/2-1)
-            {
-                datMedian[k] = *it;
-            }
 
-            if (tmp == treeMedian.size()/2)
-            {
-                datMedian[k] += *it;
-            }
-            tmp++;
+        float *blk = &blk_t[0]+t*(ds+2*nblk);
+        float *xd = blk+ds;
+        float *yd = xd+nblk;
+
+        /** block medians */
+        for (long int b=0; b<nblk; b++)
+        {
+            long int n = min((long int)ds, size-b*ds);
+            copy(x+b*ds, x+b*ds+n, blk);
+            nth_element(blk, blk+n/2, blk+n);
+            xd[b] = n%2 ? blk[n/2] : (blk[n/2]+*max_element(blk, blk+n/2))/2;
         }
-        datMedian[k] /= 2;
-        k++;
-    }
 
-    for (long int i = 1; i < size; i++)
-    {
-        a++;
-        b++;
-        if (a > 0)
-            treeMedian.erase(treeMedian.find(data[a - 1]));
-        if (b <= size)
-            treeMedian.insert(data[b - 1]);
+        heap_t[t].run(xd, yd, nblk, wds);
 
-        if (treeMedian.size()%2 == 1)
+        /** linear interpolation between block centers */
+        for (long int i=0; i<size; i++)
         {
-            int tmp = 0;
-            for (auto it=treeMedian.begin(); it!=treeMedian.end(); ++it)
+            double pos = (i-0.5*(ds-1))/ds;
+            long int b = floor(pos);
+            if (b < 0)
             {
-                if (tmp++ == treeMedian.size()/2)
-                {
-                    datMedian[k++] = *it;
-                }
+                y[i] = yd[0];
             }
-        }
-        else
-        {
-            int tmp = 0;
-            for (auto it=treeMedian.begin(); it!=treeMedian.end(); ++it)
+            else if (b >= nblk-1)
             {
-                if (tmp == treeMedian.size()/2-1)
-                {
-                    datMedian[k] = *it;
-                }
-
-                if (tmp == treeMedian.size()/2)
-                {
-                    datMedian[k] += *it;
-                }
-                tmp++;
+                y[i] = yd[nblk-1];
+            }
+            else
+            {
+                float f = pos-b;
+                y[i] = yd[b]+f*(yd[b+1]-yd[b]);
             }
-            datMedian[k] /= 2;
-            k++;
         }
     }
 }
@@ -789,6 +809,73 @@ bool get_inverse_matrix3x3(const double m[3][3], double invOut[3][3])
     return true;
 }
 
+/** first nonzero column of row i of L */
+static inline int cyclic_band_start(int i, int n, int p)
+{
+    return i >= n-p ? 0 : max(0, i-p);
+}
+
+bool cholesky_cyclic_band(float *a, int n, int p)
+{
+    for (long int i=0; i<n; i++)
+    {
+        int lo = cyclic_band_start(i, n, p);
+        for (long int j=lo; j<=i; j++)
+        {
+            double sum = a[i*n+j];
+            for (long int k=max(lo, cyclic_band_start(j, n, p)); k<j; k++)
+                sum -= (double)a[i*n+k]*a[j*n+k];
+
+            if (j < i)
+            {
+                a[i*n+j] = sum/a[j*n+j];
+            }
+            else
+            {
+                if (!(sum > 0.)) return false;
+                a[i*n+i] = sqrt(sum);
+            }
+        }
+    }
+
+    return true;
+}
+
+void cholesky_solve_cyclic_band(const float *a, int n, int p, float *b, long int nrhs)
+{
+    /** L y = b */
+    for (long int i=0; i<n; i++)
+    {
+        float *bi = b+i*nrhs;
+        for (long int k=cyclic_band_start(i, n, p); k<i; k++)
+        {
+            float l = a[i*n+k];
+            const float *bk = b+k*nrhs;
+            for (long int r=0; r<nrhs; r++)
+                bi[r] -= l*bk[r];
+        }
+        float d = 1./a[i*n+i];
+        for (long int r=0; r<nrhs; r++)
+            bi[r] *= d;
+    }
+
+    /** L^T x = y */
+    for (long int i=n-1; i>=0; i--)
+    {
+        float *bi = b+i*nrhs;
+        float d = 1./a[i*n+i];
+        for (long int r=0; r<nrhs; r++)
+            bi[r] *= d;
+        for (long int k=cyclic_band_start(i, n, p); k<i; k++)
+        {
+            float l = a[i*n+k];
+            float *bk = b+k*nrhs;
+            for (long int r=0; r<nrhs; r++)
+                bk[r] -= l*bi[r];
+        }
+    }
+}
+
 template <typename T>
 bool get_error_from_chisq_matrix(T &xerr, T &yerr, vector<T> &x, vector<T> &y, vector<T> &mxchisq)
 {